@@ -1,11 +1,17 @@
 #pragma once
 
 #include "BitArray.h"
+#include "SegmentedBitArray.h"
 #include "OutputBitStream.h"
 #include "Utilities.h"
 #include "FastUint32MultiplicationByFraction.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <exception>
+#include <vector>
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 // Binary arithmetic coder. Uses fixed-point integer arithmetic.
@@ -30,23 +36,22 @@ inline constexpr uint64_t quarterRange = highest / 4;
 inline constexpr uint64_t halfRange = highest / 2;
 inline constexpr uint64_t threeQuartersRange = highest - quarterRange;
 
-// Encode message bits
-void Encode(BitArray& inputBitArray,
-			OutputBitStream& outputBitStream,
-			double probabilityOf1) {
-
+// Creates the fast multiplication object for the probability of 0, given the probability of 1.
+//
+// Encoding and decoding with the same object (or with one recreated from its scaled multiplier)
+// is guaranteed to use the exact same interval boundaries.
+inline FastUint32MultiplicationByFraction CreateFastMultiplicationByProbabilityOf0(double probabilityOf1) {
 	// Ensure probability is within the range [0.0 + epsilon, 1.0 - epsilon]
 	probabilityOf1 = clip(probabilityOf1, 0.0 + probabilityEpsilon, 1.0 - probabilityEpsilon);
 
-	// Input bit array length
-	int64_t inputBitLength = inputBitArray.BitLength();
-
 	// Probability of 0 symbol
 	double probabilityOf0 = 1.0 - probabilityOf1;
 
-	// Fast multiplication for the probability of 0
-	FastUint32MultiplicationByFraction fastMultiplicationByProbabilityOf0(probabilityOf0);
+	return FastUint32MultiplicationByFraction(probabilityOf0);
+}
 
+// Encoder state. Can be used to resume encoding at any point.
+struct EncoderState {
 	// Current interval.
 	//
 	// To ensure no overflow for 32 bits range, we initialize `high = highest - 1`.
@@ -55,230 +60,1471 @@ void Encode(BitArray& inputBitArray,
 
 	// Pending bit count
 	int64_t pendingBitCount = 0;
+};
+
+// Decoder state. Can be used to resume decoding at any point.
+struct DecoderState {
+	// Current interval
+	uint32_t low = lowest;
+	uint32_t high = highest - 1;
+
+	// Current value derived from the input bits
+	uint32_t value = lowest;
 
-	// Read position
+	// Read position within the encoded bits
 	int64_t readPosition = 0;
+};
 
-	// Outputs a bit
-	auto outputBit = [&](uint8_t bit) { outputBitStream.WriteBit(bit); };
+// Outputs all pending bits, with the given bit value
+template <typename OutputStream>
+inline void OutputPendingBitsAs(uint8_t bit, EncoderState& state, OutputStream& outputBitStream) {
+	while (state.pendingBitCount > 0) {
+		outputBitStream.WriteBit(bit);
 
-	// Output all pending bits, with the given bit value
-	auto outputPendingBitsAs = [&](uint8_t bit) {
-		while (pendingBitCount > 0) {
-			outputBit(bit);
+		state.pendingBitCount -= 1;
+	}
+}
 
-			pendingBitCount -= 1;
-		}
-	};
+// Narrows the encoder's interval to the subinterval of the given bit
+inline void NarrowEncoderInterval(EncoderState& state,
+								  uint8_t inputBit,
+								  FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
 
-	// Encode bit by bit
-	for (int64_t readPosition = 0; readPosition < inputBitLength; readPosition++) {
-		// Narrow current interval
-		{
-			// Read new bit from input
-			uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+	// Calculate the boundary between symbols 0 and 1 within the current interval
+	// This is the point where the sub-interval for 0 ends and 1 begins
+
+	// Compute interval length
+	uint32_t intervalLength = state.high - state.low;
+
+	// Compute the lower subinterval length
+	//
+	// Slow version:
+	// uint32_t lowerSubintervalLength = uint32_t(intervalLength * probabilityOf0);
+	//
+	// Fast version using fixed-point arithmetic:
+	uint32_t lowerSubintervalLength = fastMultiplicationByProbabilityOf0.Multiply(intervalLength);
 
-			// Calculate the boundary between symbols 0 and 1 within the current interval
-			// This is the point where the sub-interval for 0 ends and 1 begins
+	// Compute the boundary
+	uint32_t boundary = state.low + lowerSubintervalLength;
+
+	if (inputBit == 0) {
+		state.high = boundary;  // New interval is [low, boundary)
+	} else {
+		state.low = boundary;	 // New interval is [boundary, high)
+	}
+}
 
-			// Compute interval length
-			uint32_t intervalLength = high - low;
+// Normalizes the encoder's interval and outputs bits
+template <typename OutputStream>
+inline void NormalizeEncoderInterval(EncoderState& state, OutputStream& outputBitStream) {
+	uint32_t low = state.low;
+	uint32_t high = state.high;
 
-			// Compute the lower subinterval length
-			//
-			// Slow version:
-			// uint32_t lowerSubintervalLength = uint32_t(intervalLength * probabilityOf0);
-			//
-			// Fast version using fixed-point arithmetic:
-			uint32_t lowerSubintervalLength = fastMultiplicationByProbabilityOf0.Multiply(intervalLength);
+	while (true) {
+		if (high < halfRange) {	// Interval is in the lower half [0, 0.5)
+			// Output 0
+			outputBitStream.WriteBit(0);
 
-			// Compute the boundary
-			uint32_t boundary = low + lowerSubintervalLength;
+			// Output pending bits as 1s
+			OutputPendingBitsAs(1, state, outputBitStream);
 
-			if (inputBit == 0) {
-				high = boundary;  // New interval is [low, boundary)
-			} else {
-				low = boundary;	 // New interval is [boundary, high)
-			}
-		}
+			// Scale up interval
+			low *= 2;
+			high *= 2;
+		} else if (low >= halfRange) {  // Interval is in the upper half [0.5, 1)
+			// Output 1
+			outputBitStream.WriteBit(1);
 
-		// Normalize the interval and output bits
-		while (true) {
-			if (high < halfRange) {	// Interval is in the lower half [0, 0.5)
-				// Output 0
-				outputBit(0);
-
-				// Output pending bits as 1s
-				outputPendingBitsAs(1);
-
-				// Scale up interval
-				low *= 2;
-				high *= 2;
-			} else if (low >= halfRange) {  // Interval is in the upper half [0.5, 1)
-				// Output 1
-				outputBit(1);
-
-				// Output pending bits as 0s
-				outputPendingBitsAs(0);
-
-				// Shift and scale up the interval
-				low = (low - halfRange) * 2;
-				high = (high - halfRange) * 2;
-			} else if (low >= quarterRange &&
-					   high < threeQuartersRange) {	// Interval is in the middle half [0.25, 0.75)
-				// Can't output a definitive bit yet, but the interval can be rescaled
-
-				// Increment pending bit count
-				pendingBitCount += 1;
-
-				// Shift and scale up the interval, to prevent precision loss
-				low = (low - quarterRange) * 2;
-				high = (high - quarterRange) * 2;
-			} else {
-				// Can't output a bit or normalize yet
-				break;
-			}
+			// Output pending bits as 0s
+			OutputPendingBitsAs(0, state, outputBitStream);
+
+			// Shift and scale up the interval
+			low = (low - halfRange) * 2;
+			high = (high - halfRange) * 2;
+		} else if (low >= quarterRange &&
+				   high < threeQuartersRange) {	// Interval is in the middle half [0.25, 0.75)
+			// Can't output a definitive bit yet, but the interval can be rescaled
+
+			// Increment pending bit count
+			state.pendingBitCount += 1;
+
+			// Shift and scale up the interval, to prevent precision loss
+			low = (low - quarterRange) * 2;
+			high = (high - quarterRange) * 2;
+		} else {
+			// Can't output a bit or normalize yet
+			break;
 		}
 	}
 
-	// Finalize
-	{
-		// Output the minimum number of bits required to uniquely identify the final interval
+	state.low = low;
+	state.high = high;
+}
+
+// Encodes a single bit
+template <typename OutputStream>
+inline void EncodeBit(EncoderState& state,
+					  uint8_t inputBit,
+					  OutputStream& outputBitStream,
+					  FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	// Narrow current interval
+	NarrowEncoderInterval(state, inputBit, fastMultiplicationByProbabilityOf0);
+
+	// Normalize the interval and output bits
+	NormalizeEncoderInterval(state, outputBitStream);
+}
+
+// Outputs the final bits, after all message bits have been encoded
+template <typename OutputStream>
+inline void FinishEncoding(EncoderState& state, OutputStream& outputBitStream) {
+	// Output the minimum number of bits required to uniquely identify the final interval
+
+	// Account for the current interval's final bit resolution
+	state.pendingBitCount += 1;
+
+	if (state.low < quarterRange) {
+		// If the current 'low' is in the first quarter [0, 0.25),
+		// the first definitive bit is 0.
+		outputBitStream.WriteBit(0);
+
+		// All previously deferred bits must be 1s to compensate for middle-half shifts
+		// that occurred in the lower part of the middle range.
+		OutputPendingBitsAs(1, state, outputBitStream);
+	} else {
+		// If the current 'low' is in the upper three quarters [0.25, 1.0),
+		// the first definitive bit is 1.
+		outputBitStream.WriteBit(1);
+
+		// All previously deferred bits must be 0s to compensate for middle-half shifts
+		// that occurred in the upper part of the middle range.
+		OutputPendingBitsAs(0, state, outputBitStream);
+	}
+}
+
+// Initializes the decoder state, by reading the initial bits into the value
+inline void InitializeDecoder(DecoderState& state, BitArray& inputBitArray) {
+	int64_t inputBitLength = inputBitArray.BitLength();
+
+	state = DecoderState();
+
+	// Determine initial bit count
+	int64_t initialBitCount = inputBitLength >= totalRangeBitWidth ? totalRangeBitWidth : inputBitLength;
+
+	// Fill value with initial bits
+	while (state.readPosition < initialBitCount) {
+		state.value *= 2;
+		state.value |= inputBitArray.ReadBitAt(state.readPosition++);
+	}
+
+	// Pad with zeros if encoded bit count is smaller than precision bit count
+	state.value = uint32_t(uint64_t(state.value) << (totalRangeBitWidth - initialBitCount));
+}
+
+// Narrows the decoder's interval, and returns the decoded bit
+inline uint8_t NarrowDecoderInterval(DecoderState& state,
+									 FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	// Calculate the boundary between symbols 0 and 1 within the current interval
+	// This is the point where the sub-interval for 0 ends and 1 begins
+	uint32_t intervalLength = state.high - state.low;
+	uint32_t lowerSubintervalLength = fastMultiplicationByProbabilityOf0.Multiply(intervalLength);
+	uint32_t boundary = state.low + lowerSubintervalLength;
+
+	// Determine the symbol based on where 'value' falls
+	if (state.value < boundary) {
+		state.high = boundary;  // New interval is [low, boundary)
+
+		return 0;
+	} else {
+		state.low = boundary;	 // New interval is [boundary, high)
+
+		return 1;
+	}
+}
 
-		// Account for the current interval's final bit resolution
-		pendingBitCount += 1;
+// Normalizes the decoder's interval (mirroring the encoder's logic)
+// This keeps 'low', 'high', and 'value' synchronized with the encoder's state.
+inline void NormalizeDecoderInterval(DecoderState& state, BitArray& inputBitArray) {
+	int64_t inputBitLength = inputBitArray.BitLength();
+
+	uint32_t low = state.low;
+	uint32_t high = state.high;
+	uint32_t value = state.value;
+	int64_t readPosition = state.readPosition;
+
+	while (true) {
+		if (high < halfRange) {	// Interval is in the lower half [0, 0.5)
+			// Scale up interval
+			low *= 2;
+			high *= 2;
+
+			// Scale up value
+			value *= 2;
+		} else if (low >= halfRange) {  // Interval is in the upper half [0.5, 1)
+			// Shift and scale up interval
+			low = (low - halfRange) * 2;
+			high = (high - halfRange) * 2;
 
-		if (low < quarterRange) {
-			// If the current 'low' is in the first quarter [0, 0.25),
-			// the first definitive bit is 0.
-			outputBit(0);
+			// Shift and scale up value
+			value = (value - halfRange) * 2;
+		} else if (low >= quarterRange &&
+				   high < threeQuartersRange) {	// Interval is in the middle half [0.25, 0.75)
+			// Shift and scale up interval
+			low = (low - quarterRange) * 2;
+			high = (high - quarterRange) * 2;
 
-			// All previously deferred bits must be 1s to compensate for middle-half shifts
-			// that occurred in the lower part of the middle range.
-			outputPendingBitsAs(1);
+			// Shift and scale up value
+			value = (value - quarterRange) * 2;
 		} else {
-			// If the current 'low' is in the upper three quarters [0.25, 1.0),
-			// the first definitive bit is 1.
-			outputBit(1);
+			// Can't normalize yet
+			break;
+		}
 
-			// All previously deferred bits must be 0s to compensate for middle-half shifts
-			// that occurred in the upper part of the middle range.
-			outputPendingBitsAs(0);
+		// Read next bit into value's least significant bit
+		//
+		// Value's least significant bit must be 0, since value was multiplied by two
+		// in all branches of the conditional, effectively being shifted left by one bit
+		if (readPosition < inputBitLength) {
+			value |= inputBitArray.ReadBitAt(readPosition++);
 		}
 	}
+
+	state.low = low;
+	state.high = high;
+	state.value = value;
+	state.readPosition = readPosition;
 }
 
-// Decode message bits given encoded bits.
-// outputBitArray should be pre-sized to the expected decoded message length.
-void Decode(BitArray& inputBitArray,
-			BitArray& outputBitArray,
-			double probabilityOf1) {
+// Decodes a single bit
+inline uint8_t DecodeBit(DecoderState& state,
+						 BitArray& inputBitArray,
+						 FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
 
-	// Ensure probability is within the range [0.0 + epsilon, 1.0 - epsilon]
-	probabilityOf1 = clip(probabilityOf1, 0.0 + probabilityEpsilon, 1.0 - probabilityEpsilon);
+	// Narrow current interval
+	uint8_t bit = NarrowDecoderInterval(state, fastMultiplicationByProbabilityOf0);
+
+	// Normalize
+	NormalizeDecoderInterval(state, inputBitArray);
+
+	return bit;
+}
+
+// Encode message bits, given a prepared multiplication object for the probability of 0
+template <typename OutputStream>
+void Encode(BitArray& inputBitArray,
+			OutputStream& outputBitStream,
+			FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
 
 	// Input bit array length
 	int64_t inputBitLength = inputBitArray.BitLength();
 
+	EncoderState state;
+
+	// Encode bit by bit
+	for (int64_t readPosition = 0; readPosition < inputBitLength; readPosition++) {
+		// Read new bit from input
+		uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+
+		EncodeBit(state, inputBit, outputBitStream, fastMultiplicationByProbabilityOf0);
+	}
+
+	// Finalize
+	FinishEncoding(state, outputBitStream);
+}
+
+// Decode message bits given encoded bits, and a prepared multiplication object for the probability of 0.
+// outputBitArray should be pre-sized to the expected decoded message length.
+inline void Decode(BitArray& inputBitArray,
+				   BitArray& outputBitArray,
+				   FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
 	// Output bit array length
 	int64_t outputBitLength = outputBitArray.BitLength();
 
-	// Probability of 0 symbol
-	double probabilityOf0 = 1.0 - probabilityOf1;
+	DecoderState state;
+
+	// Initialize value
+	InitializeDecoder(state, inputBitArray);
+
+	// Decode the specified number of bits
+	for (int64_t writePosition = 0; writePosition < outputBitLength; writePosition++) {
+		outputBitArray.WriteBitAt(writePosition, DecodeBit(state, inputBitArray, fastMultiplicationByProbabilityOf0));
+	}
+}
+
+// Encode message bits
+template <typename OutputStream>
+void Encode(BitArray& inputBitArray,
+			OutputStream& outputBitStream,
+			double probabilityOf1) {
 
 	// Fast multiplication for the probability of 0
-	FastUint32MultiplicationByFraction fastMultiplicationByProbabilityOf0(probabilityOf0);
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
 
-	// Current interval
-	uint32_t low = lowest;
-	uint32_t high = highest - 1;
+	Encode(inputBitArray, outputBitStream, fastMultiplicationByProbabilityOf0);
+}
 
-	// Current value derived from the input bits
-	uint32_t value = lowest;
+// Decode message bits given encoded bits.
+// outputBitArray should be pre-sized to the expected decoded message length.
+inline void Decode(BitArray& inputBitArray,
+				   BitArray& outputBitArray,
+				   double probabilityOf1) {
 
-	// Read and write positions
-	int64_t readPosition = 0;
-	int64_t writePosition = 0;
+	// Fast multiplication for the probability of 0
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
 
-	// Outputs a bit
-	auto outputBit = [&](uint8_t bit) { outputBitArray.WriteBitAt(writePosition++, bit); };
+	Decode(inputBitArray, outputBitArray, fastMultiplicationByProbabilityOf0);
+}
 
-	// Initialize value
-	{
-		// Determine initial bit count
-		int64_t initialBitCount = inputBitLength >= totalRangeBitWidth ? totalRangeBitWidth : inputBitLength;
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scatter-gather encoding and decoding.
+//
+// The message is given as (or decoded into) a sequence of non-contiguous segments. The coder
+// state is carried over between segments, so the result is identical to encoding or decoding
+// the concatenated segments. Segment boundaries are handled in the outer loop only.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Fill value with initial bits
-		while (readPosition < initialBitCount) {
-			value *= 2;
-			value |= inputBitArray.ReadBitAt(readPosition++);
+// Encode message bits, given as a sequence of segments
+template <typename OutputStream>
+void EncodeSegments(SegmentedBitArray& inputSegments,
+					OutputStream& outputBitStream,
+					FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	EncoderState state;
+
+	for (auto& inputBitArray : inputSegments.Segments()) {
+		int64_t inputBitLength = inputBitArray.BitLength();
+
+		for (int64_t readPosition = 0; readPosition < inputBitLength; readPosition++) {
+			uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+
+			EncodeBit(state, inputBit, outputBitStream, fastMultiplicationByProbabilityOf0);
+		}
+	}
+
+	FinishEncoding(state, outputBitStream);
+}
+
+template <typename OutputStream>
+void EncodeSegments(SegmentedBitArray& inputSegments,
+					OutputStream& outputBitStream,
+					double probabilityOf1) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	EncodeSegments(inputSegments, outputBitStream, fastMultiplicationByProbabilityOf0);
+}
+
+// Decode message bits given encoded bits, into a sequence of segments.
+// The segments should be pre-sized (and zeroed), with a total length of the decoded message length.
+inline void DecodeSegments(BitArray& inputBitArray,
+						   SegmentedBitArray& outputSegments,
+						   FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	DecoderState state;
+
+	InitializeDecoder(state, inputBitArray);
+
+	for (auto& outputBitArray : outputSegments.Segments()) {
+		int64_t outputBitLength = outputBitArray.BitLength();
+
+		for (int64_t writePosition = 0; writePosition < outputBitLength; writePosition++) {
+			outputBitArray.WriteBitAt(writePosition, DecodeBit(state, inputBitArray, fastMultiplicationByProbabilityOf0));
 		}
+	}
+}
+
+inline void DecodeSegments(BitArray& inputBitArray,
+						   SegmentedBitArray& outputSegments,
+						   double probabilityOf1) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	DecodeSegments(inputBitArray, outputSegments, fastMultiplicationByProbabilityOf0);
+}
 
-		// Pad with zeros if encoded bit count is smaller than precision bit count
-		value = value << (totalRangeBitWidth - initialBitCount);
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch encoding and decoding.
+//
+// For short messages, the fixed cost of a call (like preparing the multiplication object)
+// is significant relative to the coding work. The batch functions share one prepared
+// multiplication object, and write all messages to a single output stream.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A batch of encoded messages, stored consecutively in a single bit stream.
+// Can be reused for multiple batches, to avoid reallocating its buffers.
+struct EncodedBatch {
+	// Each message's encoded bits start at a byte boundary, so they can be viewed as a bit array
+	OutputBitStream encodedBits { 0 };
+
+	// Start offset of each message's encoded bits, in bits (always a multiple of 8)
+	std::vector<int64_t> bitOffsets;
+
+	// Encoded bit length of each message
+	std::vector<int64_t> encodedBitLengths;
+
+	int64_t MessageCount() const { return int64_t(bitOffsets.size()); }
+
+	// Gets a view of the encoded bits of the given message
+	BitArray EncodedBitsOf(int64_t messageIndex) {
+		return BitArray(encodedBits.Data() + (bitOffsets[messageIndex] / 8), encodedBitLengths[messageIndex]);
 	}
 
-	// Decode the specified number of bits
-	while (writePosition < outputBitLength) {
-		// Narrow current interval
-		{
-			// Calculate the boundary between symbols 0 and 1 within the current interval
-			// This is the point where the sub-interval for 0 ends and 1 begins
-			uint32_t intervalLength = high - low;
-			uint32_t lowerSubintervalLength = fastMultiplicationByProbabilityOf0.Multiply(intervalLength);
-			uint32_t boundary = low + lowerSubintervalLength;
-
-			// Determine the symbol based on where 'value' falls
-			if (value < boundary) {
-				outputBit(0);  // Output a 0 bit
-
-				high = boundary;  // New interval is [low, boundary)
-			} else {
-				outputBit(1);  // Output a 1 bit
-
-				low = boundary;	 // New interval is [boundary, high)
-			}
+	// Clears the batch, keeping its allocated capacity
+	void Clear() {
+		encodedBits.Reset();
+		bitOffsets.clear();
+		encodedBitLengths.clear();
+	}
+};
+
+// Encode a batch of messages, given a prepared multiplication object for the probability of 0.
+// The batch is cleared first.
+inline void EncodeBatch(BitArray* messages,
+						int64_t messageCount,
+						EncodedBatch& batch,
+						FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	batch.Clear();
+
+	batch.bitOffsets.reserve(messageCount);
+	batch.encodedBitLengths.reserve(messageCount);
+
+	auto& outputBitStream = batch.encodedBits;
+
+	for (int64_t messageIndex = 0; messageIndex < messageCount; messageIndex++) {
+		auto& message = messages[messageIndex];
+
+		int64_t startBitOffset = outputBitStream.BitLength();
+
+		int64_t inputBitLength = message.BitLength();
+
+		EncoderState state;
+
+		for (int64_t readPosition = 0; readPosition < inputBitLength; readPosition++) {
+			EncodeBit(state, message.ReadBitAt(readPosition), outputBitStream, fastMultiplicationByProbabilityOf0);
 		}
 
-		// Normalize (mirroring the encoder's logic)
-		// This keeps 'low', 'high', and 'value' synchronized with the encoder's state.
-		while (true) {
-			if (high < halfRange) {	// Interval is in the lower half [0, 0.5)
-				// Scale up interval
-				low *= 2;
-				high *= 2;
-
-				// Scale up value
-				value *= 2;
-			} else if (low >= halfRange) {  // Interval is in the upper half [0.5, 1)
-				// Shift and scale up interval
-				low = (low - halfRange) * 2;
-				high = (high - halfRange) * 2;
-
-				// Shift and scale up value
-				value = (value - halfRange) * 2;
-			} else if (low >= quarterRange &&
-					   high < threeQuartersRange) {	// Interval is in the middle half [0.25, 0.75)
-				// Shift and scale up interval
-				low = (low - quarterRange) * 2;
-				high = (high - quarterRange) * 2;
-
-				// Shift and scale up value
-				value = (value - quarterRange) * 2;
-			} else {
-				// Can't normalize yet
-				break;
-			}
+		FinishEncoding(state, outputBitStream);
 
-			// Read next bit into value's least significant bit
-			//
-			// Value's least significant bit must be 0, since value was multiplied by two
-			// in all branches of the conditional, effectively being shifted left by one bit
-			if (readPosition < inputBitLength) {
-				value |= inputBitArray.ReadBitAt(readPosition++);
-			}
+		batch.bitOffsets.push_back(startBitOffset);
+		batch.encodedBitLengths.push_back(outputBitStream.BitLength() - startBitOffset);
+
+		// Pad to a byte boundary
+		while (outputBitStream.BitLength() % 8 != 0) {
+			outputBitStream.WriteBit(0);
+		}
+	}
+}
+
+inline void EncodeBatch(std::vector<BitArray>& messages,
+						EncodedBatch& batch,
+						FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	EncodeBatch(messages.data(), int64_t(messages.size()), batch, fastMultiplicationByProbabilityOf0);
+}
+
+inline void EncodeBatch(std::vector<BitArray>& messages,
+						EncodedBatch& batch,
+						double probabilityOf1) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	EncodeBatch(messages, batch, fastMultiplicationByProbabilityOf0);
+}
+
+// Decode a batch of messages, given a prepared multiplication object for the probability of 0.
+// Each output bit array should be pre-sized (and zeroed) to the length of the corresponding message.
+inline void DecodeBatch(EncodedBatch& batch,
+						std::vector<BitArray>& outputBitArrays,
+						FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	if (int64_t(outputBitArrays.size()) != batch.MessageCount()) {
+		throw std::exception("Output bit array count doesn't match the batch message count.");
+	}
+
+	for (int64_t messageIndex = 0; messageIndex < batch.MessageCount(); messageIndex++) {
+		// Limited to the message's encoded bits, so the decoder reads zeros past its end,
+		// rather than the bits of the next message
+		auto inputBitArray = batch.EncodedBitsOf(messageIndex);
+
+		Decode(inputBitArray, outputBitArrays[messageIndex], fastMultiplicationByProbabilityOf0);
+	}
+}
+
+inline void DecodeBatch(EncodedBatch& batch,
+						std::vector<BitArray>& outputBitArrays,
+						double probabilityOf1) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	DecodeBatch(batch, outputBitArrays, fastMultiplicationByProbabilityOf0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Interleaved encoding and decoding.
+//
+// A single coder is bound by the dependency chain through its interval: each bit's multiplication
+// needs the interval produced by the previous bit. Interleaved coding splits the message into
+// `StreamCount` sub-streams, where message bit `i` is coded by sub-coder `i % StreamCount`.
+// The sub-coders are independent, so the CPU can overlap their interval updates.
+//
+// Overlapping only pays off if the sub-coders don't stall on mispredicted branches, so the
+// interleaved kernels normalize without loops: the number of shifts is found by counting leading
+// zeros, and the output bits (including pending ones) are written as a single group. The kernels
+// read and write bits most significant bit first, using whole words, and the bit order within
+// bytes is converted once per stream.
+//
+// Each sub-stream is an ordinary arithmetic coded stream (padded to a byte boundary), identical to
+// the output of `Encode` for its bits, and keeps the streaming properties of a single coder.
+// The sub-streams are packed into a single buffer:
+//
+//     [byte length of sub-streams 0 .. StreamCount - 2, as 32-bit little-endian integers]
+//     [sub-stream 0] [sub-stream 1] ... [sub-stream StreamCount - 1]
+//
+// The last sub-stream extends to the end of the buffer. The stream count isn't stored, and must be
+// the same when decoding. Encoding throws if a stored length doesn't fit in 32 bits.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Byte length of the offset header, for the given number of sub-streams
+inline constexpr int64_t InterleavedHeaderByteLength(int streamCount) {
+	return int64_t(streamCount - 1) * 4;
+}
+
+// Reverses the bit order within each byte of the given buffer. Converts between the least
+// significant bit first order of `BitArray` and `OutputBitStream`, and the most significant bit
+// first order used by the interleaved kernels.
+inline void ReverseBitOrderWithinBytes(uint8_t* bytes, int64_t byteLength) {
+	int64_t position = 0;
+
+	for (; position + 8 <= byteLength; position += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes + position, sizeof(word));
+
+		word = reverseBitsWithinBytes64(word);
+
+		std::memcpy(bytes + position, &word, sizeof(word));
+	}
+
+	for (; position < byteLength; position++) {
+		bytes[position] = uint8_t(reverseBitsWithinBytes64(bytes[position]));
+	}
+}
+
+// Writes bits, most significant bit first, into a byte buffer.
+//
+// The incomplete last byte is kept in `bitBuffer`. Every write stores 8 bytes at the write
+// position, so the buffer must have at least 8 bytes of capacity past it.
+struct InterleavedBitWriter {
+	uint64_t bitBuffer = 0;
+	int64_t bitBufferLength = 0;
+
+	int64_t writePosition = 0;
+
+	// Appends the lowest `bitCount` bits of `bits` (at most 32)
+	inline void WriteBits(uint8_t* bytes, uint64_t bits, int64_t bitCount) {
+		bitBuffer = (bitBuffer << bitCount) | bits;
+		bitBufferLength += bitCount;
+
+		// Align the buffered bits to the top of the word. Shifted in two steps, so a length of 0 is
+		// well-defined.
+		storeBigEndian64(bytes + writePosition, (bitBuffer << 1) << (63 - bitBufferLength));
+
+		writePosition += bitBufferLength / 8;
+		bitBufferLength %= 8;
+	}
+
+	// Appends a bit, followed by `repeatCount` copies of its complement, growing the buffer as needed
+	void WriteBitAndComplements(std::vector<uint8_t>& bytes, uint8_t bit, uint64_t repeatCount) {
+		EnsureCapacity(bytes);
+		WriteBits(bytes.data(), bit, 1);
+
+		uint64_t complement = bit ^ 1;
+
+		while (repeatCount > 0) {
+			int64_t chunkLength = int64_t(std::min(repeatCount, uint64_t(32)));
+
+			EnsureCapacity(bytes);
+			WriteBits(bytes.data(), complement * ((1ULL << chunkLength) - 1), chunkLength);
+
+			repeatCount -= chunkLength;
 		}
 	}
+
+	// Ensures a write of up to 32 bits has room for its 8 byte store
+	void EnsureCapacity(std::vector<uint8_t>& bytes, int64_t extraByteCount = 0) {
+		if (writePosition + 16 + extraByteCount > int64_t(bytes.size())) {
+			bytes.resize(std::max((bytes.size() * 2), size_t(writePosition + 16 + extraByteCount)));
+		}
+	}
+
+	int64_t BitLength() const { return (writePosition * 8) + bitBufferLength; }
+};
+
+// Outputs the first `shiftCount` bits of `low`, with the pending bits after the first one, bit by bit.
+// Used by the interleaved encoder when there are too many bits to write at once.
+inline void WriteSharedAndPendingBits(uint32_t low,
+									  int64_t shiftCount,
+									  uint64_t pendingBitCount,
+									  InterleavedBitWriter& writer,
+									  std::vector<uint8_t>& outputBytes) {
+
+	writer.WriteBitAndComplements(outputBytes, uint8_t(low >> 31), pendingBitCount);
+
+	for (int64_t i = 1; i < shiftCount; i++) {
+		writer.EnsureCapacity(outputBytes);
+		writer.WriteBits(outputBytes.data(), (low >> (31 - i)) & 1, 1);
+	}
+}
+
+// Encodes a single bit, without branches on the bit or the interval, in most cases.
+inline void EncodeBitInterleaved(EncoderState& state,
+								 uint8_t inputBit,
+								 InterleavedBitWriter& writer,
+								 std::vector<uint8_t>& outputBytes,
+								 FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	uint32_t low = state.low;
+	uint32_t high = state.high;
+
+	// Narrow the interval, selecting the subinterval with a mask rather than a branch
+	uint32_t lowerSubintervalLength = fastMultiplicationByProbabilityOf0.Multiply(high - low);
+	uint32_t boundary = low + lowerSubintervalLength;
+	uint32_t symbolMask = 0u - uint32_t(inputBit);
+
+	low += lowerSubintervalLength & symbolMask;
+	high = boundary + ((high - boundary) & symbolMask);
+
+	// The leading bits shared by `low` and `high` are final. Outputting them is equivalent to
+	// repeated lower and upper half normalizations.
+	int64_t shiftCount = countLeadingZeros32(low ^ high);
+	uint64_t pendingBitCount = uint64_t(state.pendingBitCount);
+
+	if (pendingBitCount + shiftCount <= 32) {
+		// Output the first shared bit, the pending bits (as its complement) and the other shared
+		// bits, as a single group
+		uint64_t firstBit = low >> 31;
+		uint64_t sharedBits = uint64_t(low) >> (32 - shiftCount);
+		uint64_t pendingBits = ((1ULL << pendingBitCount) - 1) & (0 - (firstBit ^ 1));
+
+		uint64_t head = (firstBit << pendingBitCount) | pendingBits;
+		uint64_t otherSharedBitsMask = ((1ULL << shiftCount) >> 1) - uint64_t(shiftCount > 0);
+
+		uint64_t bits = ((head << shiftCount) >> 1) | (sharedBits & otherSharedBitsMask);
+		int64_t bitCount = shiftCount > 0 ? int64_t(pendingBitCount) + shiftCount : 0;
+
+		writer.WriteBits(outputBytes.data(), shiftCount > 0 ? bits : 0, bitCount);
+	} else if (shiftCount > 0) {
+		// Too many bits for a single write (rare)
+		WriteSharedAndPendingBits(low, shiftCount, pendingBitCount, writer, outputBytes);
+	}
+
+	pendingBitCount = shiftCount > 0 ? 0 : pendingBitCount;
+
+	low = uint32_t(uint64_t(low) << shiftCount);
+	high = uint32_t(uint64_t(high) << shiftCount);
+
+	// Now `low` is in the lower half, and `high` in the upper half. The middle half normalization
+	// applies while `low` continues with 1 bits, and `high` with 0 bits. Each one maps `x` to
+	// `2 * x - halfRange`, so a number of them is a shift, and a flip of the top bit.
+	int64_t middleShiftCount = countLeadingZeros32(uint32_t(~low << 1) | uint32_t(high << 1));
+	uint32_t topBitFlip = uint32_t(halfRange) & (0u - uint32_t(middleShiftCount > 0));
+
+	state.low = uint32_t(uint64_t(low) << middleShiftCount) ^ topBitFlip;
+	state.high = uint32_t(uint64_t(high) << middleShiftCount) ^ topBitFlip;
+	state.pendingBitCount = int64_t(pendingBitCount) + middleShiftCount;
+}
+
+// Outputs the final bits of an interleaved sub-coder (see `FinishEncoding`)
+inline void FinishEncodingInterleaved(EncoderState& state, InterleavedBitWriter& writer, std::vector<uint8_t>& outputBytes) {
+	uint8_t firstBit = state.low < quarterRange ? 0 : 1;
+
+	writer.WriteBitAndComplements(outputBytes, firstBit, uint64_t(state.pendingBitCount) + 1);
+
+	state.pendingBitCount = 0;
+}
+
+// Decodes a single bit, without branches on the bit or the interval.
+//
+// `inputBytes` are the sub-stream's bytes in most significant bit first order, followed by at
+// least 8 zero bytes.
+inline uint8_t DecodeBitInterleaved(DecoderState& state,
+									const uint8_t* inputBytes,
+									int64_t inputByteLength,
+									FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	uint32_t low = state.low;
+	uint32_t high = state.high;
+
+	uint32_t lowerSubintervalLength = fastMultiplicationByProbabilityOf0.Multiply(high - low);
+	uint32_t boundary = low + lowerSubintervalLength;
+
+	uint8_t bit = state.value >= boundary ? 1 : 0;
+	uint32_t symbolMask = 0u - uint32_t(bit);
+
+	low += lowerSubintervalLength & symbolMask;
+	high = boundary + ((high - boundary) & symbolMask);
+
+	// Same normalization as the encoder (see `EncodeBitInterleaved`)
+	int64_t shiftCount = countLeadingZeros32(low ^ high);
+
+	low = uint32_t(uint64_t(low) << shiftCount);
+	high = uint32_t(uint64_t(high) << shiftCount);
+
+	int64_t middleShiftCount = countLeadingZeros32(uint32_t(~low << 1) | uint32_t(high << 1));
+	uint32_t topBitFlip = uint32_t(halfRange) & (0u - uint32_t(middleShiftCount > 0));
+
+	state.low = uint32_t(uint64_t(low) << middleShiftCount) ^ topBitFlip;
+	state.high = uint32_t(uint64_t(high) << middleShiftCount) ^ topBitFlip;
+
+	// Shift the value by the total shift count, and read as many new bits into its lowest bits.
+	// Past the end of the input, the zero padding is read.
+	int64_t totalShiftCount = shiftCount + middleShiftCount;
+	int64_t readByteIndex = std::min(state.readPosition / 8, inputByteLength);
+
+	uint64_t window = loadBigEndian64(inputBytes + readByteIndex) << (state.readPosition % 8);
+	uint64_t newBits = (window >> 1) >> (63 - totalShiftCount);
+
+	state.value = uint32_t((uint64_t(state.value) << totalShiftCount) ^ topBitFlip) | uint32_t(newBits);
+	state.readPosition += totalShiftCount;
+
+	return bit;
+}
+
+// Encode message bits into interleaved sub-streams, given a prepared multiplication object for the
+// probability of 0. The encoded bytes are appended to `outputBytes`.
+template <int StreamCount = 4>
+void EncodeInterleaved(BitArray& inputBitArray,
+					   std::vector<uint8_t>& outputBytes,
+					   FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	static_assert(StreamCount >= 1, "Stream count must be at least 1.");
+
+	int64_t inputBitLength = inputBitArray.BitLength();
+
+	EncoderState states[StreamCount];
+	InterleavedBitWriter writers[StreamCount];
+
+	// Sized for about 1 output bit per input bit, to avoid reallocations for typical inputs
+	std::vector<std::vector<uint8_t>> subStreamBytes(StreamCount, std::vector<uint8_t>(((inputBitLength / StreamCount) / 8) + 64));
+
+	int64_t readPosition = 0;
+
+	// Encode groups of bits, one for each sub-coder
+	for (; readPosition + StreamCount <= inputBitLength; readPosition += StreamCount) {
+		for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+			writers[streamIndex].EnsureCapacity(subStreamBytes[streamIndex]);
+		}
+
+		for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+			uint8_t inputBit = inputBitArray.ReadBitAt(readPosition + streamIndex);
+
+			EncodeBitInterleaved(states[streamIndex], inputBit, writers[streamIndex], subStreamBytes[streamIndex], fastMultiplicationByProbabilityOf0);
+		}
+	}
+
+	// Encode the remaining bits
+	for (int streamIndex = 0; readPosition < inputBitLength; readPosition++, streamIndex++) {
+		writers[streamIndex].EnsureCapacity(subStreamBytes[streamIndex]);
+
+		uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+
+		EncodeBitInterleaved(states[streamIndex], inputBit, writers[streamIndex], subStreamBytes[streamIndex], fastMultiplicationByProbabilityOf0);
+	}
+
+	for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+		FinishEncodingInterleaved(states[streamIndex], writers[streamIndex], subStreamBytes[streamIndex]);
+	}
+
+	// The header stores 32-bit lengths. Check them all before writing anything.
+	for (int streamIndex = 0; streamIndex < StreamCount - 1; streamIndex++) {
+		if ((writers[streamIndex].BitLength() + 7) / 8 > int64_t(UINT32_MAX)) {
+			throw std::exception("Sub-stream is too long for the interleaved header.");
+		}
+	}
+
+	// Write the header
+	for (int streamIndex = 0; streamIndex < StreamCount - 1; streamIndex++) {
+		auto byteLength = uint32_t((writers[streamIndex].BitLength() + 7) / 8);
+
+		for (int i = 0; i < 4; i++) {
+			outputBytes.push_back(uint8_t(byteLength >> (i * 8)));
+		}
+	}
+
+	// Write the sub-streams. The bits past the end of each one are zero, so it is already padded.
+	int64_t subStreamsStart = outputBytes.size();
+
+	for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+		auto byteLength = (writers[streamIndex].BitLength() + 7) / 8;
+		auto& bytes = subStreamBytes[streamIndex];
+
+		outputBytes.insert(outputBytes.end(), bytes.begin(), bytes.begin() + byteLength);
+	}
+
+	ReverseBitOrderWithinBytes(outputBytes.data() + subStreamsStart, int64_t(outputBytes.size()) - subStreamsStart);
+}
+
+template <int StreamCount = 4>
+void EncodeInterleaved(BitArray& inputBitArray,
+					   std::vector<uint8_t>& outputBytes,
+					   double probabilityOf1) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	EncodeInterleaved<StreamCount>(inputBitArray, outputBytes, fastMultiplicationByProbabilityOf0);
+}
+
+// Decode message bits from interleaved sub-streams, given a prepared multiplication object for
+// the probability of 0. `StreamCount` must be the same as the one used for encoding.
+// outputBitArray should be pre-sized (and zeroed) to the expected decoded message length.
+template <int StreamCount = 4>
+void DecodeInterleaved(const uint8_t* encodedBytes,
+					   int64_t encodedByteLength,
+					   BitArray& outputBitArray,
+					   FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0) {
+
+	static_assert(StreamCount >= 1, "Stream count must be at least 1.");
+
+	int64_t headerByteLength = InterleavedHeaderByteLength(StreamCount);
+
+	if (encodedByteLength < headerByteLength) {
+		throw std::exception("Invalid encoding: the encoded bytes are shorter than the interleaved stream header.");
+	}
+
+	// Copy the sub-streams, converted to most significant bit first order, and followed by
+	// zero padding for the word reads
+	std::vector<std::vector<uint8_t>> subStreamBytes(StreamCount);
+	int64_t subStreamByteLengths[StreamCount];
+
+	int64_t subStreamStart = headerByteLength;
+
+	for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+		int64_t byteLength = encodedByteLength - subStreamStart;
+
+		if (streamIndex < StreamCount - 1) {
+			uint32_t storedByteLength = 0;
+
+			for (int i = 0; i < 4; i++) {
+				storedByteLength |= uint32_t(encodedBytes[(streamIndex * 4) + i]) << (i * 8);
+			}
+
+			if (storedByteLength > byteLength) {
+				throw std::exception("Invalid encoding: a sub-stream extends past the end of the encoded bytes.");
+			}
+
+			byteLength = storedByteLength;
+		}
+
+		auto& bytes = subStreamBytes[streamIndex];
+
+		bytes.assign(byteLength + 8, 0);
+		std::copy(encodedBytes + subStreamStart, encodedBytes + subStreamStart + byteLength, bytes.begin());
+
+		ReverseBitOrderWithinBytes(bytes.data(), byteLength);
+
+		subStreamByteLengths[streamIndex] = byteLength;
+		subStreamStart += byteLength;
+	}
+
+	// Initialize the decoders with the first 32 bits of each sub-stream
+	DecoderState states[StreamCount];
+
+	for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+		states[streamIndex].value = uint32_t(loadBigEndian64(subStreamBytes[streamIndex].data()) >> 32);
+		states[streamIndex].readPosition = totalRangeBitWidth;
+	}
+
+	int64_t outputBitLength = outputBitArray.BitLength();
+	int64_t writePosition = 0;
+
+	// Decode groups of bits, one from each sub-coder
+	for (; writePosition + StreamCount <= outputBitLength; writePosition += StreamCount) {
+		for (int streamIndex = 0; streamIndex < StreamCount; streamIndex++) {
+			uint8_t bit = DecodeBitInterleaved(states[streamIndex], subStreamBytes[streamIndex].data(), subStreamByteLengths[streamIndex], fastMultiplicationByProbabilityOf0);
+
+			outputBitArray.WriteBitAt(writePosition + streamIndex, bit);
+		}
+	}
+
+	// Decode the remaining bits
+	for (int streamIndex = 0; writePosition < outputBitLength; writePosition++, streamIndex++) {
+		uint8_t bit = DecodeBitInterleaved(states[streamIndex], subStreamBytes[streamIndex].data(), subStreamByteLengths[streamIndex], fastMultiplicationByProbabilityOf0);
+
+		outputBitArray.WriteBitAt(writePosition, bit);
+	}
+}
+
+template <int StreamCount = 4>
+void DecodeInterleaved(const uint8_t* encodedBytes,
+					   int64_t encodedByteLength,
+					   BitArray& outputBitArray,
+					   double probabilityOf1) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	DecodeInterleaved<StreamCount>(encodedBytes, encodedByteLength, outputBitArray, fastMultiplicationByProbabilityOf0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tuple alphabet encoding and decoding.
+//
+// For independent bits with a fixed probability, groups of `tupleBitWidth` consecutive message bits
+// (2 to 8) are coded as single symbols of an alphabet of size 2^tupleBitWidth, whose probabilities
+// are the products of the bit probabilities. Each symbol takes one interval update, instead of one
+// per bit.
+//
+// Symbol probabilities are quantized to integer frequencies, totalling 2^16. Each symbol gets a
+// frequency of at least 1, so the least probable tuples are coded with a slightly higher probability
+// than their true one, and the others with a slightly lower one. The loss is small, but grows with
+// the tuple bit width, and with the skew of the probability.
+//
+// The bits of a tuple are the symbol's bits, the first message bit as the least significant one.
+// When the message length isn't a multiple of the tuple bit width, the remaining bits are coded
+// one by one, with the binary coder. The encoding is not compatible with the one of `Encode`.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline constexpr int minTupleBitWidth = 2;
+inline constexpr int maxTupleBitWidth = 8;
+
+// Tuple symbol frequencies total 2^16
+inline constexpr int tupleFrequencyBitWidth = 16;
+
+// Bit width of the index of the symbol lookup table, used by the decoder to find a starting symbol
+// for its search
+inline constexpr int tupleSymbolLookupBitWidth = 12;
+
+// Cumulative symbol frequencies for a tuple alphabet, and the tables used for decoding it
+struct TupleAlphabet {
+	int tupleBitWidth;
+
+	// Cumulative frequency of each symbol (the sum of the frequencies of the symbols before it),
+	// with an extra entry of 2^16 at the end
+	std::vector<uint32_t> cumulativeFrequencies;
+
+	// The last symbol whose cumulative frequency is at most `index << (16 - 12)`, for each index
+	std::vector<uint8_t> symbolLookup;
+
+	// Used for the remaining bits, when the message length isn't a multiple of the tuple bit width
+	FastUint32MultiplicationByFraction fastMultiplicationByProbabilityOf0;
+
+	int SymbolCount() const { return 1 << tupleBitWidth; }
+};
+
+// Creates a tuple alphabet for the given probability of 1, and tuple bit width (2 to 8)
+inline TupleAlphabet CreateTupleAlphabet(double probabilityOf1, int tupleBitWidth = 4) {
+	if (tupleBitWidth < minTupleBitWidth || tupleBitWidth > maxTupleBitWidth) {
+		throw std::exception("Tuple bit width must be between 2 and 8 (inclusive).");
+	}
+
+	TupleAlphabet alphabet = { tupleBitWidth, {}, {}, CreateFastMultiplicationByProbabilityOf0(probabilityOf1) };
+
+	probabilityOf1 = clip(probabilityOf1, 0.0 + probabilityEpsilon, 1.0 - probabilityEpsilon);
+	double probabilityOf0 = 1.0 - probabilityOf1;
+
+	int symbolCount = alphabet.SymbolCount();
+	uint32_t totalFrequency = 1u << tupleFrequencyBitWidth;
+
+	// Quantize the symbol probabilities, giving every symbol a frequency of at least 1
+	std::vector<uint32_t> frequencies(symbolCount);
+
+	int64_t frequencySum = 0;
+	int mostFrequentSymbol = 0;
+
+	for (int symbol = 0; symbol < symbolCount; symbol++) {
+		int countOf1 = popcount64(uint64_t(symbol));
+		double probability = std::pow(probabilityOf1, countOf1) * std::pow(probabilityOf0, tupleBitWidth - countOf1);
+
+		frequencies[symbol] = std::max(uint32_t(std::lround(probability * totalFrequency)), 1u);
+		frequencySum += frequencies[symbol];
+
+		if (frequencies[symbol] > frequencies[mostFrequentSymbol]) {
+			mostFrequentSymbol = symbol;
+		}
+	}
+
+	// Correct the total by adjusting the most frequent symbol, where the relative change is the smallest.
+	// At most one unit per symbol is added by the minimum frequency and the rounding, so it can't
+	// reach 0.
+	frequencies[mostFrequentSymbol] = uint32_t(int64_t(frequencies[mostFrequentSymbol]) + (int64_t(totalFrequency) - frequencySum));
+
+	// Compute cumulative frequencies
+	alphabet.cumulativeFrequencies.resize(symbolCount + 1);
+	alphabet.cumulativeFrequencies[0] = 0;
+
+	for (int symbol = 0; symbol < symbolCount; symbol++) {
+		alphabet.cumulativeFrequencies[symbol + 1] = alphabet.cumulativeFrequencies[symbol] + frequencies[symbol];
+	}
+
+	// Build the symbol lookup table
+	int lookupShift = tupleFrequencyBitWidth - tupleSymbolLookupBitWidth;
+
+	alphabet.symbolLookup.resize(1 << tupleSymbolLookupBitWidth);
+
+	int symbol = 0;
+
+	for (uint32_t index = 0; index < alphabet.symbolLookup.size(); index++) {
+		while (alphabet.cumulativeFrequencies[symbol + 1] <= (index << lookupShift)) {
+			symbol++;
+		}
+
+		alphabet.symbolLookup[index] = uint8_t(symbol);
+	}
+
+	return alphabet;
+}
+
+// Narrows an interval to the subinterval of the given tuple symbol.
+// The interval is [low, high), and the subinterval is never empty, since normalized intervals are
+// longer than 2^30.
+inline void NarrowIntervalToTupleSymbol(uint32_t& low, uint32_t& high, uint32_t symbol, TupleAlphabet& alphabet) {
+	uint64_t intervalLength = high - low;
+
+	uint32_t subintervalStart = uint32_t((intervalLength * alphabet.cumulativeFrequencies[symbol]) >> tupleFrequencyBitWidth);
+	uint32_t subintervalEnd = uint32_t((intervalLength * alphabet.cumulativeFrequencies[symbol + 1]) >> tupleFrequencyBitWidth);
+
+	high = low + subintervalEnd;
+	low = low + subintervalStart;
+}
+
+// Encode message bits as tuple symbols
+template <typename OutputStream>
+void EncodeTuples(BitArray& inputBitArray, OutputStream& outputBitStream, TupleAlphabet& alphabet) {
+	int64_t inputBitLength = inputBitArray.BitLength();
+	int tupleBitWidth = alphabet.tupleBitWidth;
+
+	EncoderState state;
+
+	int64_t readPosition = 0;
+
+	// Encode whole tuples
+	for (; readPosition + tupleBitWidth <= inputBitLength; readPosition += tupleBitWidth) {
+		uint32_t symbol = inputBitArray.ReadBitsAt(readPosition, tupleBitWidth);
+
+		NarrowIntervalToTupleSymbol(state.low, state.high, symbol, alphabet);
+		NormalizeEncoderInterval(state, outputBitStream);
+	}
+
+	// Encode the remaining bits one by one
+	for (; readPosition < inputBitLength; readPosition++) {
+		EncodeBit(state, inputBitArray.ReadBitAt(readPosition), outputBitStream, alphabet.fastMultiplicationByProbabilityOf0);
+	}
+
+	FinishEncoding(state, outputBitStream);
+}
+
+template <typename OutputStream>
+void EncodeTuples(BitArray& inputBitArray, OutputStream& outputBitStream, double probabilityOf1, int tupleBitWidth = 4) {
+	auto alphabet = CreateTupleAlphabet(probabilityOf1, tupleBitWidth);
+
+	EncodeTuples(inputBitArray, outputBitStream, alphabet);
+}
+
+// Decodes a single tuple symbol
+inline uint32_t DecodeTupleSymbol(DecoderState& state, BitArray& inputBitArray, TupleAlphabet& alphabet) {
+	uint64_t intervalLength = state.high - state.low;
+	uint64_t offset = state.value - state.low;
+
+	// The symbol's subinterval starts at or below the value when
+	// `(intervalLength * cumulativeFrequency) >> 16 <= offset`, that is, when the cumulative
+	// frequency is at most this target.
+	//
+	// The target is limited to the last frequency unit, in case the value is at the interval's end.
+	uint64_t target = std::min((((offset + 1) << tupleFrequencyBitWidth) - 1) / intervalLength, uint64_t(1 << tupleFrequencyBitWidth) - 1);
+
+	// Find the last symbol whose cumulative frequency is at most the target, starting from the one
+	// given by the lookup table
+	uint32_t symbol = alphabet.symbolLookup[target >> (tupleFrequencyBitWidth - tupleSymbolLookupBitWidth)];
+
+	while (alphabet.cumulativeFrequencies[symbol + 1] <= target) {
+		symbol++;
+	}
+
+	NarrowIntervalToTupleSymbol(state.low, state.high, symbol, alphabet);
+	NormalizeDecoderInterval(state, inputBitArray);
+
+	return symbol;
+}
+
+// Decode message bits encoded as tuple symbols.
+// outputBitArray should be pre-sized (and zeroed) to the expected decoded message length.
+inline void DecodeTuples(BitArray& inputBitArray, BitArray& outputBitArray, TupleAlphabet& alphabet) {
+	int64_t outputBitLength = outputBitArray.BitLength();
+	int tupleBitWidth = alphabet.tupleBitWidth;
+
+	DecoderState state;
+
+	InitializeDecoder(state, inputBitArray);
+
+	int64_t writePosition = 0;
+
+	// Decode whole tuples
+	for (; writePosition + tupleBitWidth <= outputBitLength; writePosition += tupleBitWidth) {
+		outputBitArray.WriteBitsAt(writePosition, DecodeTupleSymbol(state, inputBitArray, alphabet), tupleBitWidth);
+	}
+
+	// Decode the remaining bits one by one
+	for (; writePosition < outputBitLength; writePosition++) {
+		outputBitArray.WriteBitAt(writePosition, DecodeBit(state, inputBitArray, alphabet.fastMultiplicationByProbabilityOf0));
+	}
+}
+
+inline void DecodeTuples(BitArray& inputBitArray, BitArray& outputBitArray, double probabilityOf1, int tupleBitWidth = 4) {
+	auto alphabet = CreateTupleAlphabet(probabilityOf1, tupleBitWidth);
+
+	DecodeTuples(inputBitArray, outputBitArray, alphabet);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Run mode encoding and decoding.
+//
+// For highly skewed probabilities (a small probability of 1), coding bit by bit spends nearly all
+// its steps on 0s. Run mode codes the length of each run of 0s (ended by a 1) instead, so the work
+// scales with the number of 1s rather than the number of bits. Runs are found 64 bits at a time,
+// by counting trailing zeros.
+//
+// Each run length is binarized like a Golomb code with a divisor of 2^chunkBitWidth, and every
+// binary decision is arithmetic coded, with the probability it has for independent bits:
+//
+// - A decision for each full chunk of 2^chunkBitWidth 0s (probability probabilityOf0^chunkSize),
+//   ended by a decision that the run ends within the next chunk.
+// - The remainder of the run length, bit by bit, from the most significant. For independent bits,
+//   the remainder's bit `j` is 1 with probability `q / (1 + q)`, where `q = probabilityOf0^(2^j)`,
+//   regardless of the higher bits.
+//
+// Since the binarization is exact, the code length matches the one of bit by bit coding (the
+// run mode doesn't lose compression, apart from quantization of the decision probabilities).
+// The chunk bit width is chosen so a full chunk has a probability near 1/2, which minimizes the
+// number of decisions. For a probability of 1 of 0.5 or more, it is 0, and run mode is the same
+// as bit by bit coding.
+//
+// The last run, ending at the end of the message rather than at a 1, is coded like any other run.
+// The encoding is not compatible with the one of `Encode`.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline constexpr int maxRunModeChunkBitWidth = 30;
+
+// Run mode decision probabilities, for a given probability of 1
+struct RunModeParameters {
+	int chunkBitWidth;
+
+	// For the decision whether a run ends within the next chunk (1) or not (0)
+	FastUint32MultiplicationByFraction fastMultiplicationForChunkDecision;
+
+	// For each bit of the remainder, indexed by its position
+	std::vector<FastUint32MultiplicationByFraction> fastMultiplicationsForRemainderBits;
+};
+
+// Creates the run mode decision probabilities, for the given probability of 1
+inline RunModeParameters CreateRunModeParameters(double probabilityOf1) {
+	probabilityOf1 = clip(probabilityOf1, 0.0 + probabilityEpsilon, 1.0 - probabilityEpsilon);
+
+	// Natural logarithm of the probability of 0. Powers of the probability of 0 are computed
+	// through it, which is accurate for tiny probabilities of 1.
+	double logOfProbabilityOf0 = std::log1p(-probabilityOf1);
+
+	// Choose the chunk size whose probability of being all 0s is closest to 1/2
+	double idealChunkSize = std::log(2.0) / -logOfProbabilityOf0;
+
+	int chunkBitWidth = idealChunkSize <= 1.0 ? 0 : int(std::lround(std::log2(idealChunkSize)));
+	chunkBitWidth = clip(chunkBitWidth, 0, maxRunModeChunkBitWidth);
+
+	// Probability of a chunk of 0s
+	double probabilityOfFullChunk = std::exp(std::ldexp(logOfProbabilityOf0, chunkBitWidth));
+
+	RunModeParameters parameters = { chunkBitWidth, CreateFastMultiplicationByProbabilityOf0(1.0 - probabilityOfFullChunk), {} };
+
+	for (int bitIndex = 0; bitIndex < chunkBitWidth; bitIndex++) {
+		double q = std::exp(std::ldexp(logOfProbabilityOf0, bitIndex));
+
+		parameters.fastMultiplicationsForRemainderBits.push_back(CreateFastMultiplicationByProbabilityOf0(q / (1.0 + q)));
+	}
+
+	return parameters;
+}
+
+// Encodes the length of a run of 0s
+template <typename OutputStream>
+inline void EncodeRunLength(EncoderState& state, int64_t runLength, OutputStream& outputBitStream, RunModeParameters& parameters) {
+	int chunkBitWidth = parameters.chunkBitWidth;
+
+	// Full chunks
+	for (int64_t chunkCount = runLength >> chunkBitWidth; chunkCount > 0; chunkCount--) {
+		EncodeBit(state, 0, outputBitStream, parameters.fastMultiplicationForChunkDecision);
+	}
+
+	// End of the run, within the next chunk
+	EncodeBit(state, 1, outputBitStream, parameters.fastMultiplicationForChunkDecision);
+
+	// Remainder
+	for (int bitIndex = chunkBitWidth - 1; bitIndex >= 0; bitIndex--) {
+		uint8_t bit = uint8_t((runLength >> bitIndex) & 1);
+
+		EncodeBit(state, bit, outputBitStream, parameters.fastMultiplicationsForRemainderBits[bitIndex]);
+	}
+}
+
+// Decodes the length of a run of 0s. Runs longer than `maxRunLength` can only come from invalid
+// encoded bits, and stop decoding early (returning a length larger than `maxRunLength`), so invalid
+// encoded bits can't cause an unbounded number of decoded chunks.
+inline int64_t DecodeRunLength(DecoderState& state, BitArray& inputBitArray, int64_t maxRunLength, RunModeParameters& parameters) {
+	int chunkBitWidth = parameters.chunkBitWidth;
+
+	int64_t chunkCount = 0;
+
+	while (DecodeBit(state, inputBitArray, parameters.fastMultiplicationForChunkDecision) == 0) {
+		chunkCount++;
+
+		if ((chunkCount << chunkBitWidth) > maxRunLength) {
+			return maxRunLength + 1;
+		}
+	}
+
+	int64_t remainder = 0;
+
+	for (int bitIndex = chunkBitWidth - 1; bitIndex >= 0; bitIndex--) {
+		remainder = (remainder << 1) | DecodeBit(state, inputBitArray, parameters.fastMultiplicationsForRemainderBits[bitIndex]);
+	}
+
+	return (chunkCount << chunkBitWidth) + remainder;
+}
+
+// Encode message bits in run mode, given prepared run mode parameters
+template <typename OutputStream>
+void EncodeRuns(BitArray& inputBitArray, OutputStream& outputBitStream, RunModeParameters& parameters) {
+	int64_t inputBitLength = inputBitArray.BitLength();
+
+	EncoderState state;
+
+	int64_t readPosition = 0;
+
+	while (true) {
+		int64_t nextOnePosition = inputBitArray.FindNextSetBit(readPosition);
+
+		EncodeRunLength(state, nextOnePosition - readPosition, outputBitStream, parameters);
+
+		// The last run ends at the end of the message
+		if (nextOnePosition == inputBitLength) {
+			break;
+		}
+
+		readPosition = nextOnePosition + 1;
+	}
+
+	FinishEncoding(state, outputBitStream);
+}
+
+// Encode message bits in run mode
+template <typename OutputStream>
+void EncodeRuns(BitArray& inputBitArray, OutputStream& outputBitStream, double probabilityOf1) {
+	auto parameters = CreateRunModeParameters(probabilityOf1);
+
+	EncodeRuns(inputBitArray, outputBitStream, parameters);
+}
+
+// Decode message bits encoded in run mode, given prepared run mode parameters.
+// outputBitArray should be pre-sized (and zeroed) to the expected decoded message length.
+// Only the 1s are written.
+inline void DecodeRuns(BitArray& inputBitArray, BitArray& outputBitArray, RunModeParameters& parameters) {
+	int64_t outputBitLength = outputBitArray.BitLength();
+
+	DecoderState state;
+
+	InitializeDecoder(state, inputBitArray);
+
+	int64_t writePosition = 0;
+
+	while (true) {
+		writePosition += DecodeRunLength(state, inputBitArray, outputBitLength - writePosition, parameters);
+
+		// The last run ends at the end of the message (or past it, for invalid encoded bits)
+		if (writePosition >= outputBitLength) {
+			break;
+		}
+
+		outputBitArray.WriteBitAt(writePosition, 1);
+		writePosition++;
+	}
+}
+
+// Decode message bits encoded in run mode.
+// outputBitArray should be pre-sized (and zeroed) to the expected decoded message length.
+inline void DecodeRuns(BitArray& inputBitArray, BitArray& outputBitArray, double probabilityOf1) {
+	auto parameters = CreateRunModeParameters(probabilityOf1);
+
+	DecodeRuns(inputBitArray, outputBitArray, parameters);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpoint index, for random access into encoded bits.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The decoder state, just before decoding a particular message bit
+struct Checkpoint {
+	uint32_t low;
+	uint32_t high;
+	uint32_t value;
+
+	// Read position within the encoded bits
+	int64_t readPosition;
+};
+
+// Checkpoints for every `checkpointInterval` message bits.
+// Checkpoint `i` holds the decoder state just before decoding message bit `i * checkpointInterval`.
+struct CheckpointIndex {
+	int64_t checkpointInterval = 0;
+
+	// Bit length of the indexed message
+	int64_t messageBitLength = 0;
+
+	std::vector<Checkpoint> checkpoints;
+};
+
+// Encode message bits, and record a checkpoint every `checkpointInterval` bits.
+//
+// The decoder's `low` and `high` are always identical to the encoder's, and its read position is
+// 32 bits ahead of the encoder's normalization shift count (the number of output bits, including
+// pending ones). The decoder's `value` depends on bits that the encoder only outputs later,
+// so it is filled in after encoding completes.
+template <typename OutputStream>
+void EncodeWithCheckpoints(BitArray& inputBitArray,
+						   OutputStream& outputBitStream,
+						   FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0,
+						   int64_t checkpointInterval,
+						   CheckpointIndex& checkpointIndex) {
+
+	if (checkpointInterval < 1) {
+		throw std::exception("Checkpoint interval must be at least 1.");
+	}
+
+	int64_t inputBitLength = inputBitArray.BitLength();
+
+	// Checkpoint positions are relative to the start of the encoded bits
+	int64_t outputStartBitLength = outputBitStream.BitLength();
+
+	checkpointIndex.checkpointInterval = checkpointInterval;
+	checkpointIndex.messageBitLength = inputBitLength;
+	checkpointIndex.checkpoints.clear();
+	checkpointIndex.checkpoints.reserve((inputBitLength + checkpointInterval - 1) / checkpointInterval);
+
+	EncoderState state;
+
+	for (int64_t readPosition = 0; readPosition < inputBitLength; readPosition++) {
+		if (readPosition % checkpointInterval == 0) {
+			int64_t shiftCount = (outputBitStream.BitLength() - outputStartBitLength) + state.pendingBitCount;
+
+			// Temporarily store the normalization shift count as the read position, and whether the
+			// last shift was a middle-half shift (indicated by pending bits) in the value
+			uint32_t valueOffset = state.pendingBitCount > 0 ? uint32_t(halfRange) : 0;
+
+			checkpointIndex.checkpoints.push_back({ state.low, state.high, valueOffset, shiftCount });
+		}
+
+		uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+
+		EncodeBit(state, inputBit, outputBitStream, fastMultiplicationByProbabilityOf0);
+	}
+
+	FinishEncoding(state, outputBitStream);
+
+	// Fill in the decoder values and read positions, now that all encoded bits are known
+	int64_t encodedBitLength = outputBitStream.BitLength() - outputStartBitLength;
+
+	BitArray encodedBitArray(outputBitStream.Data(), outputBitStream.BitLength());
+
+	for (auto& checkpoint : checkpointIndex.checkpoints) {
+		int64_t shiftCount = checkpoint.readPosition;
+
+		// Read the 32 encoded bits following the shift count (padded with zeros past the end)
+		uint32_t window = 0;
+
+		for (int64_t i = shiftCount; i < shiftCount + totalRangeBitWidth; i++) {
+			window *= 2;
+
+			if (i < encodedBitLength) {
+				window |= encodedBitArray.ReadBitAt(outputStartBitLength + i);
+			}
+		}
+
+		// Every normalization shift subtracts the same offset from `value` and `low`.
+		// Modulo 2^32, all accumulated offsets cancel out, except for the quarter-range offset
+		// of a middle-half shift, when it was the most recent one (it is doubled to half range).
+		checkpoint.value = window - checkpoint.value;
+		checkpoint.readPosition = std::min(shiftCount + totalRangeBitWidth, encodedBitLength);
+	}
+}
+
+// Encode message bits, and record a checkpoint every `checkpointInterval` bits
+template <typename OutputStream>
+void EncodeWithCheckpoints(BitArray& inputBitArray,
+						   OutputStream& outputBitStream,
+						   double probabilityOf1,
+						   int64_t checkpointInterval,
+						   CheckpointIndex& checkpointIndex) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	EncodeWithCheckpoints(inputBitArray, outputBitStream, fastMultiplicationByProbabilityOf0, checkpointInterval, checkpointIndex);
+}
+
+// Decode `count` message bits, starting at message bit `start`, by seeking to the nearest
+// preceding checkpoint. Decoded bits are written to outputBitArray, starting at its position 0.
+// Throws if the range extends past the end of the indexed message.
+inline void DecodeRange(BitArray& inputBitArray,
+						FastUint32MultiplicationByFraction& fastMultiplicationByProbabilityOf0,
+						CheckpointIndex& checkpointIndex,
+						int64_t start,
+						int64_t count,
+						BitArray& outputBitArray) {
+
+	if (count <= 0) {
+		return;
+	}
+
+	int64_t checkpointNumber = start / checkpointIndex.checkpointInterval;
+
+	if (start < 0 || checkpointNumber >= int64_t(checkpointIndex.checkpoints.size())) {
+		throw std::exception("Start position is out of range of the checkpoint index.");
+	}
+
+	if (count > checkpointIndex.messageBitLength - start) {
+		throw std::exception("Range extends past the end of the message.");
+	}
+
+	if (count > outputBitArray.BitLength()) {
+		throw std::exception("Output bit array is too short.");
+	}
+
+	auto& checkpoint = checkpointIndex.checkpoints[checkpointNumber];
+
+	DecoderState state;
+	state.low = checkpoint.low;
+	state.high = checkpoint.high;
+	state.value = checkpoint.value;
+	state.readPosition = checkpoint.readPosition;
+
+	// Decode and discard the bits between the checkpoint and the start position
+	for (int64_t position = checkpointNumber * checkpointIndex.checkpointInterval; position < start; position++) {
+		DecodeBit(state, inputBitArray, fastMultiplicationByProbabilityOf0);
+	}
+
+	for (int64_t writePosition = 0; writePosition < count; writePosition++) {
+		outputBitArray.WriteBitAt(writePosition, DecodeBit(state, inputBitArray, fastMultiplicationByProbabilityOf0));
+	}
+}
+
+// Decode `count` message bits, starting at message bit `start`
+inline void DecodeRange(BitArray& inputBitArray,
+						double probabilityOf1,
+						CheckpointIndex& checkpointIndex,
+						int64_t start,
+						int64_t count,
+						BitArray& outputBitArray) {
+
+	auto fastMultiplicationByProbabilityOf0 = CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	DecodeRange(inputBitArray, fastMultiplicationByProbabilityOf0, checkpointIndex, start, count, outputBitArray);
 }
 
 }
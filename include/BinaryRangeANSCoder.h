@@ -1,11 +1,21 @@
 #pragma once
 
 #include "BitArray.h"
+#include "SegmentedBitArray.h"
 #include "OutputBitStream.h"
+#include "FrontGrowableByteBuffer.h"
 #include "Utilities.h"
 #include "FastUint31Division.h"
+#include "Uint32DivisionStrategies.h"
+#include "DivisionBenchmark.h"
 
+#include <algorithm>
+#include <atomic>
 #include <exception>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
 
 using namespace EntropyCodingUtilities;
 
@@ -14,8 +24,77 @@ struct StateAndSymbol {
     uint8_t symbol;
 };
 
+// The decoder state, just before decoding a particular message bit
+struct BinaryRangeANSCheckpoint {
+	uint32_t state;
+
+	// Read position within the encoded bytes
+	int64_t readPosition;
+};
+
+// Checkpoints for every `checkpointInterval` message bits.
+// Checkpoint `i` holds the decoder state just before decoding message bit `i * checkpointInterval`.
+struct BinaryRangeANSCheckpointIndex {
+	int64_t checkpointInterval = 0;
+
+	// Bit length of the indexed message
+	int64_t messageBitLength = 0;
+
+	std::vector<BinaryRangeANSCheckpoint> checkpoints;
+};
+
+// A batch of encoded messages, stored consecutively in a single byte arena.
+// Can be reused for multiple batches, to avoid reallocating its buffers.
+struct BinaryRangeANSEncodedBatch {
+	std::vector<uint8_t> encodedBytes;
+
+	// Offset of each message's encoded bytes (with an extra entry for the end offset)
+	std::vector<uint64_t> byteOffsets;
+
+	// Final encoder state of each message
+	std::vector<uint32_t> finalStates;
+
+	int64_t MessageCount() const { return int64_t(finalStates.size()); }
+
+	// Clears the batch, keeping its allocated capacity
+	void Clear() {
+		encodedBytes.clear();
+		byteOffsets.clear();
+		finalStates.clear();
+	}
+};
+
+// A chain of messages, encoded as a single stream.
+//
+// Each message's encoding continues from the state left by the previous one, so there's no
+// per-message state to store: only the bit length of each message, and a single final state for
+// the whole chain. Messages can only be decoded in order, starting from the first one.
+struct BinaryRangeANSEncodedChain {
+	std::vector<uint8_t> encodedBytes;
+
+	// Bit length of each message
+	std::vector<int64_t> messageBitLengths;
+
+	// Final encoder state of the whole chain
+	uint32_t finalState = 0;
+
+	int64_t MessageCount() const { return int64_t(messageBitLengths.size()); }
+
+	// Clears the chain, keeping its allocated capacity
+	void Clear() {
+		encodedBytes.clear();
+		messageBitLengths.clear();
+		finalState = 0;
+	}
+};
+
 // Range Asymmetric Numeral Systems (rANS) encoder and decoder for a binary alphabet (0 and 1),
 // with optional support for table-based processing (tANS).
+//
+// Once constructed (and optionally, configured with `SetDivisionStrategy`), a coder is an immutable
+// model: all encoding and decoding methods are const, and keep their state in local variables only.
+// Any number of threads can encode and decode concurrently using the same coder, without locking.
+// Building the tables is thread-safe as well.
 class BinaryRangeANSCoder {
    private:
 	uint32_t totalRangeBitWidth;
@@ -26,11 +105,46 @@ class BinaryRangeANSCoder {
 	uint32_t encoderFlushThresholdOf[2];
 	FastUint31Division fastDivisionForFrequencyOf[2];
 
-	std::vector<uint32_t> encoderStateTransitionTable;
-	std::vector<StateAndSymbol> decoderStateTransitionTable;
+	// Alternative division strategies for the symbol frequencies.
+	// All produce identical results, and only differ in speed.
+	Uint32DivisionStrategy divisionStrategy;
+	HardwareUint32Division hardwareDivisionForFrequencyOf[2];
+	LemireUint32Division lemireDivisionForFrequencyOf[2];
+	ReciprocalUint32Division reciprocalDivisionForFrequencyOf[2];
+
+	// State transition tables (optional). Allocated from the memory resource given on construction.
+	//
+	// Each table is built at most once, even when requested by multiple threads concurrently,
+	// and is shared by all copies of the coder.
+	struct TableStorage {
+		std::pmr::vector<uint32_t> encoderStateTransitionTable;
+		std::pmr::vector<StateAndSymbol> decoderStateTransitionTable;
+
+		std::once_flag encoderTableOnceFlag;
+		std::once_flag decoderTableOnceFlag;
+
+		std::atomic<bool> encoderTableIsReady { false };
+		std::atomic<bool> decoderTableIsReady { false };
+
+		TableStorage(std::pmr::memory_resource* memoryResource)
+			: encoderStateTransitionTable(memoryResource),
+			  decoderStateTransitionTable(memoryResource) {
+		}
+	};
+
+	std::shared_ptr<TableStorage> tableStorage;
 
    public:
-	BinaryRangeANSCoder(double probabilityOf1, uint8_t totalRangeBitWidth) {
+	// The state transition tables, if built, are allocated from the given memory resource.
+	// Copies of the coder share the same tables.
+	//
+	// For large range widths, allocating the tables from a `HugePageMemoryResource` can reduce
+	// TLB misses during table lookups. The effect depends on the table size and the CPU.
+	BinaryRangeANSCoder(double probabilityOf1,
+						uint8_t totalRangeBitWidth,
+						std::pmr::memory_resource* tableMemoryResource = std::pmr::get_default_resource())
+		: tableStorage(std::make_shared<TableStorage>(tableMemoryResource)) {
+
 		if (probabilityOf1 < 0.0 || probabilityOf1 > 1.0) {
 			throw std::exception("Probability of 1 must be between 0.0 and 1.0.");
 		}
@@ -42,6 +156,44 @@ class BinaryRangeANSCoder {
 		// Probability of symbol 0
 		double probabilityOf0 = 1.0 - probabilityOf1;
 
+		// Total frequency of all symbols
+		uint32_t totalFrequency = 1u << totalRangeBitWidth;
+
+		// Compute frequency of symbol 0
+		auto frequencyOf0 = uint32_t(round(probabilityOf0 * totalFrequency));
+
+		// Ensure frequencies are at least 1
+		frequencyOf0 = clip(frequencyOf0, 1u, totalFrequency - 1);
+
+		Initialize(frequencyOf0, totalRangeBitWidth);
+	}
+
+	// Creates a coder directly from a quantized frequency of symbol 0, in the range
+	// [1, 2^totalRangeBitWidth - 1]. For example, a frequency previously returned by `GetFrequencyOf(0)`.
+	static BinaryRangeANSCoder FromFrequencyOf0(uint32_t frequencyOf0,
+												uint8_t totalRangeBitWidth,
+												std::pmr::memory_resource* tableMemoryResource = std::pmr::get_default_resource()) {
+		if (totalRangeBitWidth < 2 || totalRangeBitWidth > 23) {
+			throw std::exception("Total range bit width must be between 2 and 23 (inclusive).");
+		}
+
+		if (frequencyOf0 < 1 || frequencyOf0 >= (1u << totalRangeBitWidth)) {
+			throw std::exception("Frequency of 0 must be between 1 and 2^totalRangeBitWidth - 1 (inclusive).");
+		}
+
+		BinaryRangeANSCoder coder(tableMemoryResource);
+		coder.Initialize(frequencyOf0, totalRangeBitWidth);
+
+		return coder;
+	}
+
+   private:
+	BinaryRangeANSCoder(std::pmr::memory_resource* tableMemoryResource)
+		: tableStorage(std::make_shared<TableStorage>(tableMemoryResource)) {
+	}
+
+	// Initializes the coder, given a frequency of symbol 0 that is already quantized and validated
+	void Initialize(uint32_t frequencyOf0, uint8_t totalRangeBitWidth) {
 		// Total size of the integer range, in bits.
 		// Determines how "quantized" the symbol probabilities would be.
 		// Recommended widths are between 6 and 20 bits.
@@ -59,12 +211,6 @@ class BinaryRangeANSCoder {
 		// Total frequency of all symbols
 		this->totalFrequency = 1u << totalRangeBitWidth;
 
-		// Compute frequency of symbol 0
-		auto frequencyOf0 = uint32_t(round(probabilityOf0 * totalFrequency));
-
-		// Ensure frequencies are at least 1
-		frequencyOf0 = clip(frequencyOf0, 1u, totalFrequency - 1);
-
 		// Lookup table for frequencies of symbols
 		frequencyOf[0] = frequencyOf0;
 		frequencyOf[1] = totalFrequency - frequencyOf0;
@@ -80,16 +226,106 @@ class BinaryRangeANSCoder {
 		// Lookup table for fast division object for the symbol frequencies
 		fastDivisionForFrequencyOf[0] = FastUint31Division(frequencyOf[0]);
 		fastDivisionForFrequencyOf[1] = FastUint31Division(frequencyOf[1]);
+
+		// Lookup tables for the alternative division strategies
+		hardwareDivisionForFrequencyOf[0] = HardwareUint32Division(frequencyOf[0]);
+		hardwareDivisionForFrequencyOf[1] = HardwareUint32Division(frequencyOf[1]);
+
+		lemireDivisionForFrequencyOf[0] = LemireUint32Division(frequencyOf[0]);
+		lemireDivisionForFrequencyOf[1] = LemireUint32Division(frequencyOf[1]);
+
+		reciprocalDivisionForFrequencyOf[0] = ReciprocalUint32Division(frequencyOf[0]);
+		reciprocalDivisionForFrequencyOf[1] = ReciprocalUint32Division(frequencyOf[1]);
+
+		// Use the fastest division strategy for the current CPU, by default
+		SetDivisionStrategy(Uint32DivisionStrategy::Automatic);
+	}
+
+   public:
+	// Gets the total range bit width
+	uint8_t GetTotalRangeBitWidth() const { return uint8_t(totalRangeBitWidth); }
+
+	// Gets the total frequency of all symbols (2^totalRangeBitWidth)
+	uint32_t GetTotalFrequency() const { return totalFrequency; }
+
+	// Gets the quantized frequency of the given symbol (0 or 1)
+	uint32_t GetFrequencyOf(uint8_t symbol) const { return frequencyOf[symbol]; }
+
+	// Sets the division strategy used by the (non table-based) encoder.
+	//
+	// `Automatic` selects the fastest strategy for the current CPU. The first time it is used,
+	// it runs a short benchmark (a few milliseconds), and caches the result for the rest of the process.
+	//
+	// Since all strategies produce identical results, changing it never affects the encoded output.
+	// Not thread-safe: should be set before the coder is shared between threads.
+	void SetDivisionStrategy(Uint32DivisionStrategy strategy) {
+		if (strategy == Uint32DivisionStrategy::Automatic) {
+			strategy = DivisionBenchmark::GetFastestDivisionStrategy();
+		}
+
+		divisionStrategy = strategy;
 	}
 
+	// Gets the division strategy used by the (non table-based) encoder
+	Uint32DivisionStrategy GetDivisionStrategy() const { return divisionStrategy; }
+
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Encoding and decoding methods (non table-based).
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	// Encode message bits
-	uint32_t Encode(BitArray& inputBitArray, std::vector<uint8_t>& outputBytes) {
-		uint32_t state = totalFrequency;
+	// Encode message bits.
+	//
+	// The output can be any byte container supporting `size`, `push_back`, `begin` and `end`
+	// (like `std::vector<uint8_t>`, or a memory-mapped output file).
+	template <typename OutputBytes>
+	uint32_t Encode(BitArray& inputBitArray, OutputBytes& outputBytes) const {
+		// Dispatch once to a loop specialized for the selected division strategy
+		switch (divisionStrategy) {
+			case Uint32DivisionStrategy::Hardware:
+				return EncodeUsingDivision(inputBitArray, outputBytes, hardwareDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Lemire:
+				return EncodeUsingDivision(inputBitArray, outputBytes, lemireDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Reciprocal:
+				return EncodeUsingDivision(inputBitArray, outputBytes, reciprocalDivisionForFrequencyOf);
+			default:
+				return EncodeUsingDivision(inputBitArray, outputBytes, fastDivisionForFrequencyOf);
+		}
+	}
+
+	// Encode message bits, using the given division objects for the symbol frequencies
+	template <typename Division, typename OutputBytes>
+	uint32_t EncodeUsingDivision(BitArray& inputBitArray, OutputBytes& outputBytes, Division* divisionForFrequencyOf) const {
+		// Encoded bytes are appended after any existing content of the output vector
+		int64_t outputStartPosition = outputBytes.size();
 
+		uint32_t state = EncodeBitsUsingDivision(inputBitArray, outputBytes, divisionForFrequencyOf, totalFrequency);
+
+		// Reverse flushed bytes so the decoder can read them in forward order,
+		// to correctly recreate the states seen during encoding, in reverse order.
+		std::reverse(outputBytes.begin() + outputStartPosition, outputBytes.end());
+
+		// Return the final state.
+		//
+		// The final state is guaranteed to be in the range [0, totalFrequency * 256).
+		// So, for a range of 8 bits, it will fit 16 bits.
+		// For range of 16 bits, it will fit 24 bits.
+		// For 24 bits, it will fit 32 bits (maximum supported).
+		//
+		// For now, I don't serialize the state to bytes, because there are many
+		// ways to do so. For example, using plain fixed-length byte encodings,
+		// variable-length encodings, etc.
+		//
+		// Every range size would have a different serialization method that would be optimal
+		// for it, so it makes it difficult to find a one-fits-all solution.
+		return state;
+	}
+
+	// Encode message bits starting from the given state, and return the resulting state.
+	//
+	// Flushed bytes are appended in encoding order (reversed), so the caller has to reverse
+	// them once all bits of the message are encoded.
+	template <typename Division, typename OutputBytes>
+	uint32_t EncodeBitsUsingDivision(BitArray& inputBitArray, OutputBytes& outputBytes, Division* divisionForFrequencyOf, uint32_t state) const {
 		// Iterate message bits in reverse order
 		for (int64_t readPosition = inputBitArray.BitLength() - 1; readPosition >= 0; readPosition--) {
 			// Take message bit
@@ -115,26 +351,9 @@ class BinaryRangeANSCoder {
 			}
 
 			// Compute the state transition and transition to the new state
-			state = ComputeEncoderStateTransitionFor(state, symbol);
+			state = ComputeEncoderStateTransitionUsing(divisionForFrequencyOf[symbol], state, symbol);
 		}
 
-		// Reverse flushed bytes so the decoder can read them in forward order,
-		// to correctly recreate the states seen during encoding, in reverse order.
-		std::reverse(outputBytes.begin(), outputBytes.end());
-
-		// Return the final state.
-		//
-		// The final state is guaranteed to be in the range [0, totalFrequency * 256).
-		// So, for a range of 8 bits, it will fit 16 bits.
-		// For range of 16 bits, it will fit 24 bits.
-		// For 24 bits, it will fit 32 bits (maximum supported).
-		//
-		// For now, I don't serialize the state to bytes, because there are many
-		// ways to do so. For example, using plain fixed-length byte encodings,
-		// variable-length encodings, etc.
-		//
-		// Every range size would have a different serialization method that would be optimal
-		// for it, so it makes it difficult to find a one-fits-all solution.
 		return state;
 	}
 
@@ -143,12 +362,25 @@ class BinaryRangeANSCoder {
 	void Decode(uint8_t* encodedBytes,
 				int64_t encodedByteLength,
 				uint32_t state,
-				BitArray& outputBitArray) {
-
-		auto outputBitLength = outputBitArray.BitLength();
+				BitArray& outputBitArray) const {
 
 		int64_t readPosition = 0;
 
+		DecodeBitsFrom(encodedBytes, encodedByteLength, state, readPosition, outputBitArray);
+	}
+
+	// Decode bits into the entire output bit array, starting from the given state and read position,
+	// and leave both as they are after the last bit. Used by all methods that decode with
+	// `ComputeDecoderStateTransitionFor`, including the ones carrying the state across several
+	// outputs (segments or chained messages).
+	void DecodeBitsFrom(const uint8_t* encodedBytes,
+						int64_t encodedByteLength,
+						uint32_t& state,
+						int64_t& readPosition,
+						BitArray& outputBitArray) const {
+
+		auto outputBitLength = outputBitArray.BitLength();
+
 		for (int64_t writePosition = 0; writePosition < outputBitLength; writePosition++) {
 			// While state is smaller than the threshold, read a byte (aka "unflush") into the state.
 			//
@@ -168,6 +400,335 @@ class BinaryRangeANSCoder {
 		}
 	}
 
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Incremental encoding methods, prepending to an existing stream.
+	//
+	// rANS is last-in, first-out: given the final state and encoded bytes of a previous encoding,
+	// more bits can be encoded by resuming from that state. The newly flushed bytes precede the old
+	// ones in the stream, and the old bytes are left untouched. The work is proportional only to the
+	// new bits.
+	//
+	// Decoding the result (with the new final state) produces the new bits first, followed by the
+	// previously encoded bits. The stream is identical to encoding the concatenation in one pass.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Gets the state to start prepending from, for a new, empty stream
+	uint32_t GetInitialEncoderState() const { return totalFrequency; }
+
+	// Encode message bits in front of an existing stream, resuming from its final state.
+	// Returns the new final state.
+	//
+	// The flushed bytes are prepended to `encodedBytes`. For a new stream, start with an empty buffer,
+	// and the state returned by `GetInitialEncoderState`.
+	uint32_t EncodeInFront(BitArray& inputBitArray, FrontGrowableByteBuffer& encodedBytes, uint32_t state) const {
+		switch (divisionStrategy) {
+			case Uint32DivisionStrategy::Hardware:
+				return EncodeInFrontUsingDivision(inputBitArray, encodedBytes, state, hardwareDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Lemire:
+				return EncodeInFrontUsingDivision(inputBitArray, encodedBytes, state, lemireDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Reciprocal:
+				return EncodeInFrontUsingDivision(inputBitArray, encodedBytes, state, reciprocalDivisionForFrequencyOf);
+			default:
+				return EncodeInFrontUsingDivision(inputBitArray, encodedBytes, state, fastDivisionForFrequencyOf);
+		}
+	}
+
+	template <typename Division>
+	uint32_t EncodeInFrontUsingDivision(BitArray& inputBitArray,
+										FrontGrowableByteBuffer& encodedBytes,
+										uint32_t state,
+										Division* divisionForFrequencyOf) const {
+
+		if (state < totalFrequency || state >= totalFrequency * 256) {
+			throw std::exception("State is out of the range of valid encoder states.");
+		}
+
+		// Bytes are flushed in reverse stream order, so prepending them one by one places them
+		// in stream order, without a separate reversal step.
+		PrependingOutput output { encodedBytes };
+
+		return EncodeBitsUsingDivision(inputBitArray, output, divisionForFrequencyOf, state);
+	}
+
+   private:
+	// Adapts a front-growable buffer to the byte output interface used by the encoder,
+	// prepending bytes rather than appending them
+	struct PrependingOutput {
+		FrontGrowableByteBuffer& buffer;
+
+		inline void push_back(uint8_t byte) { buffer.PushFront(byte); }
+	};
+
+   public:
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Encoding and decoding methods with data carried in the initial state.
+	//
+	// The regular encoder starts from the fixed state `totalFrequency`, so the final state always
+	// carries about `totalRangeBitWidth` bits of no information. Here, the last
+	// `totalRangeBitWidth` message bits (or fewer, for shorter messages) are stored, as is, in the
+	// initial state instead: `totalFrequency + bits`. Since the initial state is less than
+	// `2 * totalFrequency`, this costs at most 1 extra bit.
+	//
+	// The decoder decodes the other bits as usual, then reads back the bytes flushed from the initial
+	// state, and extracts the stored bits from it.
+	//
+	// Saves up to `totalRangeBitWidth` bits per message (less for highly compressible messages,
+	// since the stored bits would otherwise cost less than 1 bit each). The encoding isn't compatible
+	// with the regular one.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Number of message bits stored in the initial state, for a message of the given length
+	int64_t GetInitialStateDataBitCountFor(int64_t messageBitLength) const {
+		return std::min(messageBitLength, int64_t(totalRangeBitWidth));
+	}
+
+	// Encode message bits, storing the last message bits in the initial state
+	template <typename OutputBytes>
+	uint32_t EncodeWithDataInInitialState(BitArray& inputBitArray, OutputBytes& outputBytes) const {
+		switch (divisionStrategy) {
+			case Uint32DivisionStrategy::Hardware:
+				return EncodeWithDataInInitialStateUsingDivision(inputBitArray, outputBytes, hardwareDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Lemire:
+				return EncodeWithDataInInitialStateUsingDivision(inputBitArray, outputBytes, lemireDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Reciprocal:
+				return EncodeWithDataInInitialStateUsingDivision(inputBitArray, outputBytes, reciprocalDivisionForFrequencyOf);
+			default:
+				return EncodeWithDataInInitialStateUsingDivision(inputBitArray, outputBytes, fastDivisionForFrequencyOf);
+		}
+	}
+
+	template <typename Division, typename OutputBytes>
+	uint32_t EncodeWithDataInInitialStateUsingDivision(BitArray& inputBitArray, OutputBytes& outputBytes, Division* divisionForFrequencyOf) const {
+		int64_t outputStartPosition = outputBytes.size();
+
+		int64_t dataBitCount = GetInitialStateDataBitCountFor(inputBitArray.BitLength());
+		int64_t encodedBitLength = inputBitArray.BitLength() - dataBitCount;
+
+		// Store the last message bits in the initial state
+		uint32_t initialState = totalFrequency;
+
+		for (int64_t i = 0; i < dataBitCount; i++) {
+			initialState |= uint32_t(inputBitArray.ReadBitAt(encodedBitLength + i)) << i;
+		}
+
+		// Encode the preceding message bits, starting from that state
+		BitArray encodedBitArray(inputBitArray.Data(), encodedBitLength);
+
+		uint32_t state = EncodeBitsUsingDivision(encodedBitArray, outputBytes, divisionForFrequencyOf, initialState);
+
+		std::reverse(outputBytes.begin() + outputStartPosition, outputBytes.end());
+
+		return state;
+	}
+
+	// Decode bits encoded by `EncodeWithDataInInitialState`, given encoded bytes and state.
+	// outputBitArray should be pre-sized to the expected decoded message length.
+	void DecodeWithDataInInitialState(uint8_t* encodedBytes,
+									  int64_t encodedByteLength,
+									  uint32_t state,
+									  BitArray& outputBitArray) const {
+
+		int64_t dataBitCount = GetInitialStateDataBitCountFor(outputBitArray.BitLength());
+		int64_t encodedBitLength = outputBitArray.BitLength() - dataBitCount;
+
+		int64_t readPosition = 0;
+
+		BitArray encodedBitArray(outputBitArray.Data(), encodedBitLength);
+
+		DecodeBitsFrom(encodedBytes, encodedByteLength, state, readPosition, encodedBitArray);
+
+		// Read back the bytes flushed from the initial state, when encoding the first bit
+		while (state < totalFrequency && readPosition < encodedByteLength) {
+			state = (state << 8) | uint32_t(encodedBytes[readPosition++]);
+		}
+
+		uint32_t initialStateData = state - totalFrequency;
+
+		if (state < totalFrequency || (initialStateData >> dataBitCount) != 0) {
+			throw std::exception("Invalid encoding: the recovered initial state is out of range.");
+		}
+
+		for (int64_t i = 0; i < dataBitCount; i++) {
+			outputBitArray.WriteBitAt(encodedBitLength + i, uint8_t((initialStateData >> i) & 1));
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Scatter-gather encoding and decoding methods.
+	//
+	// The message is given as (or decoded into) a sequence of non-contiguous segments. The state
+	// is carried over between segments, so the result is identical to encoding or decoding the
+	// concatenated segments. Segment boundaries are handled in the outer loop only, leaving the
+	// per-bit loop unchanged.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Encode message bits, given as a sequence of segments
+	template <typename OutputBytes>
+	uint32_t EncodeSegments(SegmentedBitArray& inputSegments, OutputBytes& outputBytes) const {
+		switch (divisionStrategy) {
+			case Uint32DivisionStrategy::Hardware:
+				return EncodeSegmentsUsingDivision(inputSegments, outputBytes, hardwareDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Lemire:
+				return EncodeSegmentsUsingDivision(inputSegments, outputBytes, lemireDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Reciprocal:
+				return EncodeSegmentsUsingDivision(inputSegments, outputBytes, reciprocalDivisionForFrequencyOf);
+			default:
+				return EncodeSegmentsUsingDivision(inputSegments, outputBytes, fastDivisionForFrequencyOf);
+		}
+	}
+
+	template <typename Division, typename OutputBytes>
+	uint32_t EncodeSegmentsUsingDivision(SegmentedBitArray& inputSegments, OutputBytes& outputBytes, Division* divisionForFrequencyOf) const {
+		int64_t outputStartPosition = outputBytes.size();
+
+		uint32_t state = totalFrequency;
+
+		// Message bits are encoded in reverse order, so segments are iterated in reverse order as well
+		for (int64_t segmentIndex = inputSegments.SegmentCount() - 1; segmentIndex >= 0; segmentIndex--) {
+			state = EncodeBitsUsingDivision(inputSegments.Segment(segmentIndex), outputBytes, divisionForFrequencyOf, state);
+		}
+
+		std::reverse(outputBytes.begin() + outputStartPosition, outputBytes.end());
+
+		return state;
+	}
+
+	// Decode bits given encoded bytes and state, into a sequence of segments.
+	// The segments should be pre-sized (and zeroed), with a total length of the decoded message length.
+	void DecodeSegments(uint8_t* encodedBytes,
+						int64_t encodedByteLength,
+						uint32_t state,
+						SegmentedBitArray& outputSegments) const {
+
+		int64_t readPosition = 0;
+
+		// The state (and read position) is carried over from one segment to the next
+		for (auto& outputBitArray : outputSegments.Segments()) {
+			DecodeBitsFrom(encodedBytes, encodedByteLength, state, readPosition, outputBitArray);
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Batch encoding and decoding methods.
+	//
+	// For short messages (up to a few thousand bits), the fixed cost of a call, like dispatching on
+	// the division strategy and growing a separate output vector, is significant relative to the
+	// coding work. The batch methods pay it once per batch, and write all messages to a single arena.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Encode a batch of messages. The batch is cleared first.
+	void EncodeBatch(std::vector<BitArray>& messages, BinaryRangeANSEncodedBatch& batch) const {
+		EncodeBatch(messages.data(), int64_t(messages.size()), batch);
+	}
+
+	void EncodeBatch(BitArray* messages, int64_t messageCount, BinaryRangeANSEncodedBatch& batch) const {
+		switch (divisionStrategy) {
+			case Uint32DivisionStrategy::Hardware:
+				return EncodeBatchUsingDivision(messages, messageCount, batch, hardwareDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Lemire:
+				return EncodeBatchUsingDivision(messages, messageCount, batch, lemireDivisionForFrequencyOf);
+			case Uint32DivisionStrategy::Reciprocal:
+				return EncodeBatchUsingDivision(messages, messageCount, batch, reciprocalDivisionForFrequencyOf);
+			default:
+				return EncodeBatchUsingDivision(messages, messageCount, batch, fastDivisionForFrequencyOf);
+		}
+	}
+
+	template <typename Division>
+	void EncodeBatchUsingDivision(BitArray* messages,
+								  int64_t messageCount,
+								  BinaryRangeANSEncodedBatch& batch,
+								  Division* divisionForFrequencyOf) const {
+		batch.Clear();
+
+		batch.byteOffsets.reserve(messageCount + 1);
+		batch.finalStates.reserve(messageCount);
+
+		auto& encodedBytes = batch.encodedBytes;
+
+		for (int64_t messageIndex = 0; messageIndex < messageCount; messageIndex++) {
+			auto& message = messages[messageIndex];
+
+			int64_t outputStartPosition = encodedBytes.size();
+
+			uint32_t state = EncodeBitsUsingDivision(message, encodedBytes, divisionForFrequencyOf, totalFrequency);
+
+			std::reverse(encodedBytes.begin() + outputStartPosition, encodedBytes.end());
+
+			batch.byteOffsets.push_back(uint64_t(outputStartPosition));
+			batch.finalStates.push_back(state);
+		}
+
+		batch.byteOffsets.push_back(encodedBytes.size());
+	}
+
+	// Decode a batch of messages. Each output bit array should be pre-sized (and zeroed) to the
+	// length of the corresponding message.
+	void DecodeBatch(BinaryRangeANSEncodedBatch& batch, std::vector<BitArray>& outputBitArrays) const {
+		if (int64_t(outputBitArrays.size()) != batch.MessageCount()) {
+			throw std::exception("Output bit array count doesn't match the batch message count.");
+		}
+
+		uint8_t* encodedBytes = batch.encodedBytes.data();
+
+		for (int64_t messageIndex = 0; messageIndex < batch.MessageCount(); messageIndex++) {
+			uint64_t byteOffset = batch.byteOffsets[messageIndex];
+			uint64_t byteLength = batch.byteOffsets[messageIndex + 1] - byteOffset;
+
+			Decode(encodedBytes + byteOffset, int64_t(byteLength), batch.finalStates[messageIndex], outputBitArrays[messageIndex]);
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Chained encoding and decoding methods.
+	//
+	// A sequence of messages is encoded into a single stream, carrying the state over from one message
+	// to the next. Compared to a batch, this saves storing a final state per message (2 - 4 bytes), and
+	// the partially filled state at the end of each message, which matters most for short messages.
+	//
+	// The stream is identical to the encoding of the concatenated messages, so a chain is encoded and
+	// decoded as a sequence of segments (see `EncodeSegments` and `DecodeSegments`), one per message.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Encode a sequence of messages as a chain. The chain is cleared first.
+	void EncodeChain(std::vector<BitArray>& messages, BinaryRangeANSEncodedChain& chain) const {
+		EncodeChain(messages.data(), int64_t(messages.size()), chain);
+	}
+
+	void EncodeChain(BitArray* messages, int64_t messageCount, BinaryRangeANSEncodedChain& chain) const {
+		chain.Clear();
+
+		chain.messageBitLengths.reserve(messageCount);
+
+		SegmentedBitArray inputSegments;
+
+		for (int64_t messageIndex = 0; messageIndex < messageCount; messageIndex++) {
+			chain.messageBitLengths.push_back(messages[messageIndex].BitLength());
+
+			inputSegments.AddSegment(messages[messageIndex]);
+		}
+
+		chain.finalState = EncodeSegments(inputSegments, chain.encodedBytes);
+	}
+
+	// Decode all messages of a chain. Each output bit array should be pre-sized (and zeroed) to the
+	// length of the corresponding message.
+	void DecodeChain(BinaryRangeANSEncodedChain& chain, std::vector<BitArray>& outputBitArrays) const {
+		if (int64_t(outputBitArrays.size()) != chain.MessageCount()) {
+			throw std::exception("Output bit array count doesn't match the chain message count.");
+		}
+
+		for (int64_t messageIndex = 0; messageIndex < chain.MessageCount(); messageIndex++) {
+			if (outputBitArrays[messageIndex].BitLength() != chain.messageBitLengths[messageIndex]) {
+				throw std::exception("Output bit array length doesn't match the message bit length.");
+			}
+		}
+
+		SegmentedBitArray outputSegments(outputBitArrays);
+
+		DecodeSegments(chain.encodedBytes.data(), int64_t(chain.encodedBytes.size()), chain.finalState, outputSegments);
+	}
+
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Table-based encoding and decoding methods.
 	//
@@ -179,13 +740,18 @@ class BinaryRangeANSCoder {
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	// Encode bits using table. Requires encoder state transition table to be built first.
-	uint32_t EncodeUsingTable(BitArray& inputBitArray, std::vector<uint8_t>& outputBytes) {
+	template <typename OutputBytes>
+	uint32_t EncodeUsingTable(BitArray& inputBitArray, OutputBytes& outputBytes) const {
 		if (!HasEncoderStateTransitionTable()) {
 			throw std::exception("Encoder state transition table has not been built.");
 		}
 
+		const uint32_t* encoderStateTransitionTable = tableStorage->encoderStateTransitionTable.data();
+
 		uint32_t state = totalFrequency;
 
+		int64_t outputStartPosition = outputBytes.size();
+
 		for (int64_t readPosition = inputBitArray.BitLength() - 1; readPosition >= 0; readPosition--) {
 			auto symbol = inputBitArray.ReadBitAt(readPosition);
 
@@ -196,10 +762,10 @@ class BinaryRangeANSCoder {
 				state >>= 8;
 			}
 
-			state = LookupEncoderStateTransitionFor(state, symbol);
+			state = encoderStateTransitionTable[(uint64_t(state) * 2) + symbol];
 		}
 
-		std::reverse(outputBytes.begin(), outputBytes.end());
+		std::reverse(outputBytes.begin() + outputStartPosition, outputBytes.end());
 
 		return state;
 	}
@@ -208,12 +774,14 @@ class BinaryRangeANSCoder {
 	void DecodeUsingTable(uint8_t* encodedBytes,
 						  int64_t encodedByteLength,
 						  uint32_t state,
-						  BitArray& outputBitArray) {
+						  BitArray& outputBitArray) const {
 
 		if (!HasDecoderStateTransitionTable()) {
 			throw std::exception("Decoder state transition table has not been built.");
 		}
 
+		const StateAndSymbol* decoderStateTransitionTable = tableStorage->decoderStateTransitionTable.data();
+
 		int64_t outputBitLength = outputBitArray.BitLength();
 
 		int64_t readPosition = 0;
@@ -223,7 +791,7 @@ class BinaryRangeANSCoder {
 				state = (state << 8) | uint32_t(encodedBytes[readPosition++]);
 			}
 
-			auto stateTransitionResult = LookupDecoderStateTransitionFor(state);
+			auto stateTransitionResult = decoderStateTransitionTable[state];
 
 			state = stateTransitionResult.state;
 
@@ -231,21 +799,246 @@ class BinaryRangeANSCoder {
 		}
 	}
 
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Checkpoint index, for random access into encoded bytes.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Encode message bits, and record a checkpoint every `checkpointInterval` bits.
+	//
+	// After encoding bit `i` (in reverse order), the encoder's state is exactly the state the
+	// decoder will have just before decoding bit `i`. At that point, the decoder will have read all
+	// bytes flushed after it (which are placed before it, once reversed).
+	uint32_t EncodeWithCheckpoints(BitArray& inputBitArray,
+								   std::vector<uint8_t>& outputBytes,
+								   int64_t checkpointInterval,
+								   BinaryRangeANSCheckpointIndex& checkpointIndex) const {
+
+		if (checkpointInterval < 1) {
+			throw std::exception("Checkpoint interval must be at least 1.");
+		}
+
+		int64_t inputBitLength = inputBitArray.BitLength();
+
+		checkpointIndex.checkpointInterval = checkpointInterval;
+		checkpointIndex.messageBitLength = inputBitLength;
+		checkpointIndex.checkpoints.clear();
+		checkpointIndex.checkpoints.reserve((inputBitLength + checkpointInterval - 1) / checkpointInterval);
+
+		uint32_t state = totalFrequency;
+
+		int64_t outputStartPosition = outputBytes.size();
+
+		for (int64_t readPosition = inputBitLength - 1; readPosition >= 0; readPosition--) {
+			auto symbol = inputBitArray.ReadBitAt(readPosition);
+
+			auto flushThreshold = encoderFlushThresholdOf[symbol];
+
+			while (state >= flushThreshold) {
+				outputBytes.push_back(state & 255);
+				state >>= 8;
+			}
+
+			state = ComputeEncoderStateTransitionFor(state, symbol);
+
+			if (readPosition % checkpointInterval == 0) {
+				// Temporarily store the count of bytes flushed so far as the read position
+				int64_t flushedByteCount = int64_t(outputBytes.size()) - outputStartPosition;
+
+				checkpointIndex.checkpoints.push_back({ state, flushedByteCount });
+			}
+		}
+
+		std::reverse(outputBytes.begin() + outputStartPosition, outputBytes.end());
+
+		// Checkpoints were recorded in reverse order. Reorder them, and convert the flushed byte
+		// counts to decoder read positions.
+		std::reverse(checkpointIndex.checkpoints.begin(), checkpointIndex.checkpoints.end());
+
+		int64_t encodedByteLength = int64_t(outputBytes.size()) - outputStartPosition;
+
+		for (auto& checkpoint : checkpointIndex.checkpoints) {
+			checkpoint.readPosition = encodedByteLength - checkpoint.readPosition;
+		}
+
+		return state;
+	}
+
+	// Decode `count` message bits, starting at message bit `start`, by seeking to the nearest
+	// preceding checkpoint. Decoded bits are written to outputBitArray, starting at its position 0.
+	// Throws if the range extends past the end of the indexed message.
+	void DecodeRange(uint8_t* encodedBytes,
+					 int64_t encodedByteLength,
+					 BinaryRangeANSCheckpointIndex& checkpointIndex,
+					 int64_t start,
+					 int64_t count,
+					 BitArray& outputBitArray) const {
+
+		if (count <= 0) {
+			return;
+		}
+
+		int64_t checkpointNumber = start / checkpointIndex.checkpointInterval;
+
+		if (start < 0 || checkpointNumber >= int64_t(checkpointIndex.checkpoints.size())) {
+			throw std::exception("Start position is out of range of the checkpoint index.");
+		}
+
+		if (count > checkpointIndex.messageBitLength - start) {
+			throw std::exception("Range extends past the end of the message.");
+		}
+
+		if (count > outputBitArray.BitLength()) {
+			throw std::exception("Output bit array is too short.");
+		}
+
+		auto& checkpoint = checkpointIndex.checkpoints[checkpointNumber];
+
+		uint32_t state = checkpoint.state;
+		int64_t readPosition = checkpoint.readPosition;
+
+		int64_t endPosition = start + count;
+
+		for (int64_t position = checkpointNumber * checkpointIndex.checkpointInterval; position < endPosition; position++) {
+			while (state < totalFrequency && readPosition < encodedByteLength) {
+				state = (state << 8) | uint32_t(encodedBytes[readPosition++]);
+			}
+
+			auto stateTransitionResult = ComputeDecoderStateTransitionFor(state);
+
+			state = stateTransitionResult.state;
+
+			// Bits before the start position are decoded and discarded
+			if (position >= start) {
+				outputBitArray.WriteBitAt(position - start, stateTransitionResult.symbol);
+			}
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Fused decoding methods.
+	//
+	// Decode directly to positions, counts or run lengths, without producing the decoded bits.
+	// On sparse data, this avoids writing (and later scanning) a mostly empty bit array.
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Decode `bitLength` bits, and pass each decoded symbol to the given handler,
+	// as `handleSymbol(position, symbol)`
+	template <typename SymbolHandler>
+	void DecodeWithHandler(uint8_t* encodedBytes,
+						   int64_t encodedByteLength,
+						   uint32_t state,
+						   int64_t bitLength,
+						   SymbolHandler&& handleSymbol) const {
+
+		int64_t readPosition = 0;
+
+		for (int64_t position = 0; position < bitLength; position++) {
+			while (state < totalFrequency && readPosition < encodedByteLength) {
+				state = (state << 8) | uint32_t(encodedBytes[readPosition++]);
+			}
+
+			auto stateTransitionResult = ComputeDecoderStateTransitionFor(state);
+
+			state = stateTransitionResult.state;
+
+			handleSymbol(position, stateTransitionResult.symbol);
+		}
+	}
+
+	// Decode `bitLength` bits, and append the positions of all occurrences of the given symbol
+	// (by default, 1) to the positions vector. Position type can be `uint32_t` or `uint64_t`.
+	template <typename Position>
+	void DecodeToPositions(uint8_t* encodedBytes,
+						   int64_t encodedByteLength,
+						   uint32_t state,
+						   int64_t bitLength,
+						   std::vector<Position>& positions,
+						   uint8_t symbol = 1) const {
+
+		// Reserve the expected number of positions. The product is split into whole multiples of the
+		// total frequency and a remainder, so it can't overflow for very long messages.
+		uint64_t frequency = frequencyOf[symbol];
+		uint64_t expectedPositionCount = ((uint64_t(bitLength) >> totalRangeBitWidth) * frequency) +
+										 (((uint64_t(bitLength) & (totalFrequency - 1)) * frequency) >> totalRangeBitWidth);
+
+		expectedPositionCount = std::min(expectedPositionCount, uint64_t(positions.max_size() - positions.size()));
+
+		positions.reserve(positions.size() + size_t(expectedPositionCount));
+
+		DecodeWithHandler(encodedBytes, encodedByteLength, state, bitLength, [&](int64_t position, uint8_t decodedSymbol) {
+			if (decodedSymbol == symbol) {
+				positions.push_back(Position(position));
+			}
+		});
+	}
+
+	// Decode `bitLength` bits, and return the number of 1 bits
+	int64_t DecodeToCount(uint8_t* encodedBytes,
+						  int64_t encodedByteLength,
+						  uint32_t state,
+						  int64_t bitLength) const {
+
+		int64_t oneCount = 0;
+
+		DecodeWithHandler(encodedBytes, encodedByteLength, state, bitLength, [&](int64_t, uint8_t decodedSymbol) {
+			oneCount += decodedSymbol;
+		});
+
+		return oneCount;
+	}
+
+	// Decode `bitLength` bits, and append the lengths of the runs of identical bits to the
+	// run lengths vector. Runs alternate between 0s and 1s, starting with a (possibly empty) run of 0s.
+	template <typename RunLength>
+	void DecodeToRunLengths(uint8_t* encodedBytes,
+							int64_t encodedByteLength,
+							uint32_t state,
+							int64_t bitLength,
+							std::vector<RunLength>& runLengths) const {
+
+		uint8_t currentSymbol = 0;
+		int64_t currentRunStart = 0;
+
+		DecodeWithHandler(encodedBytes, encodedByteLength, state, bitLength, [&](int64_t position, uint8_t decodedSymbol) {
+			if (decodedSymbol != currentSymbol) {
+				runLengths.push_back(RunLength(position - currentRunStart));
+
+				currentSymbol = decodedSymbol;
+				currentRunStart = position;
+			}
+		});
+
+		if (bitLength > 0) {
+			runLengths.push_back(RunLength(bitLength - currentRunStart));
+		}
+	}
+
+	// Gets the symbol with the lower (or equal) frequency
+	uint8_t GetMinoritySymbol() const { return frequencyOf[1] <= frequencyOf[0] ? 1 : 0; }
+
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	// State transition computation methods
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	// Given a starting state and symbol, compute the next encoder state
-	inline uint32_t ComputeEncoderStateTransitionFor(uint32_t state, uint8_t symbol) {
+	inline uint32_t ComputeEncoderStateTransitionFor(uint32_t state, uint8_t symbol) const {
+		// Fast version,
+		// Uses fast division based on a single 64-bit multiplication and a single right shift.
+		return ComputeEncoderStateTransitionUsing(fastDivisionForFrequencyOf[symbol], state, symbol);
+	}
+
+	// Given a starting state and symbol, compute the next encoder state,
+	// using the given division object for the frequency of the symbol
+	template <typename Division>
+	inline uint32_t ComputeEncoderStateTransitionUsing(Division& divisionForFrequency, uint32_t state, uint8_t symbol) const {
 		// Compute quotient and remainder based on the state and frequency of the symbol
 		//
 		// Slow version:
 		//uint32_t quotient = state / frequencyOf[symbol];
 		//uint32_t remainder = state % frequencyOf[symbol];
 		//
-		// Fast version,
-		// Uses fast division based on a single 64-bit multiplication and a single right shift:
-		auto divisionResult = fastDivisionForFrequencyOf[symbol].DivideAndGetRemainder(state);
+		// Fast versions are provided by the division object (see `Uint32DivisionStrategies.h`)
+		auto divisionResult = divisionForFrequency.DivideAndGetRemainder(state);
 		uint32_t quotient = divisionResult.quotient;
 		uint32_t remainder = divisionResult.remainder;
 
@@ -256,7 +1049,7 @@ class BinaryRangeANSCoder {
 	}
 
 	// Given a starting state, compute the next decoder state and the emitted symbol
-	inline StateAndSymbol ComputeDecoderStateTransitionFor(uint32_t state) {
+	inline StateAndSymbol ComputeDecoderStateTransitionFor(uint32_t state) const {
 		// Compute quotient and remainder based on the state and total frequency.
 		//
 		// Slow version:
@@ -283,71 +1076,89 @@ class BinaryRangeANSCoder {
 
 	// Looks up encoder transition in the table.
 	// Doesn't check if the table is empty or if arguments are out of range.
-	inline uint32_t LookupEncoderStateTransitionFor(uint32_t state, uint8_t symbol) {
-		return encoderStateTransitionTable[(uint64_t(state) * 2) + symbol];
+	inline uint32_t LookupEncoderStateTransitionFor(uint32_t state, uint8_t symbol) const {
+		return tableStorage->encoderStateTransitionTable[(uint64_t(state) * 2) + symbol];
 	}
 
 	// Looks up decoder transition in the table.
 	// Doesn't check if the table is empty or if arguments are out of range.
-	inline StateAndSymbol LookupDecoderStateTransitionFor(uint32_t state) {
-		return decoderStateTransitionTable[state];
+	inline StateAndSymbol LookupDecoderStateTransitionFor(uint32_t state) const {
+		return tableStorage->decoderStateTransitionTable[state];
 	}
 
 	// Builds the encoder's state transition table
-	// (optional, needs to be explicitly called to enable table-based encoding)
-	void BuildEncoderStateTransitionTable() {
+	// (optional, needs to be explicitly called to enable table-based encoding).
+	//
+	// Thread-safe. If called concurrently, the table is built once, and all callers
+	// return after it is ready.
+	void BuildEncoderStateTransitionTable() const {
 		if (HasEncoderStateTransitionTable()) {
 			return;
 		}
 
-		// The size of the encoder table is the total frequency times 256.
-		// A state value cannot be greater than or equal to this value.
-		auto stateCount = uint64_t(totalFrequency) * 256;
+		std::call_once(tableStorage->encoderTableOnceFlag, [this]() {
+			auto& encoderStateTransitionTable = tableStorage->encoderStateTransitionTable;
 
-		// Reserve memory
-		encoderStateTransitionTable.reserve(stateCount * 2);
+			// The size of the encoder table is the total frequency times 256.
+			// A state value cannot be greater than or equal to this value.
+			auto stateCount = uint64_t(totalFrequency) * 256;
 
-		// Append two consecutive table entries for each state, one for symbol 0 and other for symbol 1
-		for (uint32_t stateValue = 0; stateValue < stateCount; stateValue++) {
-			auto followingStateFor0 = ComputeEncoderStateTransitionFor(stateValue, 0);
-			auto followingStateFor1 = ComputeEncoderStateTransitionFor(stateValue, 1);
+			// Reserve memory
+			encoderStateTransitionTable.reserve(stateCount * 2);
 
-			encoderStateTransitionTable.push_back(followingStateFor0);
-			encoderStateTransitionTable.push_back(followingStateFor1);
-		}
+			// Append two consecutive table entries for each state, one for symbol 0 and other for symbol 1
+			for (uint32_t stateValue = 0; stateValue < stateCount; stateValue++) {
+				auto followingStateFor0 = ComputeEncoderStateTransitionFor(stateValue, 0);
+				auto followingStateFor1 = ComputeEncoderStateTransitionFor(stateValue, 1);
+
+				encoderStateTransitionTable.push_back(followingStateFor0);
+				encoderStateTransitionTable.push_back(followingStateFor1);
+			}
+
+			tableStorage->encoderTableIsReady.store(true, std::memory_order_release);
+		});
 	}
 
 	// Build the decoder's state transition table
-	// (optional, needs to be explicitly called to enable table-based decoding)
-	void BuildDecoderStateTransitionTable() {
+	// (optional, needs to be explicitly called to enable table-based decoding).
+	//
+	// Thread-safe. If called concurrently, the table is built once, and all callers
+	// return after it is ready.
+	void BuildDecoderStateTransitionTable() const {
 		if (HasDecoderStateTransitionTable()) {
 			return;
 		}
 
-		// The size of the decoder table is the total frequency times 256.
-		// A state value cannot be equal to or greater than this value.
-		auto stateCount = uint64_t(totalFrequency) * 256;
+		std::call_once(tableStorage->decoderTableOnceFlag, [this]() {
+			auto& decoderStateTransitionTable = tableStorage->decoderStateTransitionTable;
 
-		// Reserve memory
-		decoderStateTransitionTable.reserve(stateCount);
+			// The size of the decoder table is the total frequency times 256.
+			// A state value cannot be equal to or greater than this value.
+			auto stateCount = uint64_t(totalFrequency) * 256;
 
-		// Append a single table entry for each state
-		for (uint32_t stateValue = 0; stateValue < stateCount; stateValue++) {
-			auto followingStateAndSymbol = ComputeDecoderStateTransitionFor(stateValue);
+			// Reserve memory
+			decoderStateTransitionTable.reserve(stateCount);
 
-			decoderStateTransitionTable.push_back(followingStateAndSymbol);
-		}
+			// Append a single table entry for each state
+			for (uint32_t stateValue = 0; stateValue < stateCount; stateValue++) {
+				auto followingStateAndSymbol = ComputeDecoderStateTransitionFor(stateValue);
+
+				decoderStateTransitionTable.push_back(followingStateAndSymbol);
+			}
+
+			tableStorage->decoderTableIsReady.store(true, std::memory_order_release);
+		});
 	}
 
 	// Has an encoder state transition table been built?
-	bool HasEncoderStateTransitionTable() { return encoderStateTransitionTable.size() > 0; }
+	bool HasEncoderStateTransitionTable() const { return tableStorage->encoderTableIsReady.load(std::memory_order_acquire); }
 
 	// Has a decoder state transition table been built?
-	bool HasDecoderStateTransitionTable() { return decoderStateTransitionTable.size() > 0; }
+	bool HasDecoderStateTransitionTable() const { return tableStorage->decoderTableIsReady.load(std::memory_order_acquire); }
 
 	// Computes the total memory size, in bytes, required by an encoder state transition table
-	uint64_t GetEncoderStateTransitionTableMemorySize() { return uint64_t(totalFrequency) * 256 * sizeof(uint32_t) * 2; }
+	uint64_t GetEncoderStateTransitionTableMemorySize() const { return uint64_t(totalFrequency) * 256 * sizeof(uint32_t) * 2; }
 
 	// Computes the total memory size, in bytes, required by a decoder state transition table
-	uint64_t GetDecoderStateTransitionTableMemorySize() { return uint64_t(totalFrequency) * 256 * sizeof(StateAndSymbol); }
+	uint64_t GetDecoderStateTransitionTableMemorySize() const { return uint64_t(totalFrequency) * 256 * sizeof(StateAndSymbol); }
 };
@@ -0,0 +1,444 @@
+#pragma once
+
+#include "BitArray.h"
+#include "BinaryRangeANSCoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Lane-parallel binary rANS encoding and decoding of multiple independent messages.
+//
+// A single rANS message is a serial chain of state transitions, so it can't be vectorized
+// without changing the format (interleaving). Instead, these kernels process a group of
+// `LaneCount` (typically 8 or 16) different messages at once, one per lane. Each lane has its own
+// state, its own model (messages can use different frequencies), and its own output.
+//
+// The per-step work is written as simple loops over the lanes, on structure-of-arrays data, so the
+// compiler can auto-vectorize them (especially when compiled for AVX2 or AVX-512):
+//
+// - Divisions use a double precision reciprocal (like `ReciprocalUint32Division`), since
+//   floating point multiplication vectorizes well, unlike 64-bit multiply-high or integer division.
+// - Renormalization is done in a fixed number of masked rounds (at most 3 bytes can be
+//   flushed or read per bit), rather than a data-dependent loop.
+// - Messages of different lengths (ragged) are handled by masking out lanes whose message
+//   has ended.
+//
+// Each step is a chain of dependent operations (conversions, multiplications), so a single vector
+// of lanes is bound by latency. 16 lanes (the default) give the processor two or more independent
+// vectors to overlap.
+//
+// Flushed bytes are first stored in a per-step matrix, and compacted into each lane's output
+// afterwards. The encoded output of each message is identical to `BinaryRangeANSCoder::Encode`,
+// and can be decoded by either decoder.
+//
+// The kernels are compiled for the build's target. `CoderKernelDispatch` provides the `EncodeBatch`
+// and `DecodeBatch` functions (with the default lane count) compiled for the best instruction set
+// level supported by the current CPU.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace BinaryRangeANSLanes {
+
+// Per-lane model parameters, in structure-of-arrays layout
+template <int64_t LaneCount>
+struct LaneModels {
+	uint32_t totalFrequency[LaneCount];
+	uint32_t totalRangeBitWidth[LaneCount];
+
+	uint32_t frequencyOf0[LaneCount];
+	uint32_t frequencyOf1[LaneCount];
+
+	uint32_t flushThresholdOf0[LaneCount];
+	uint32_t flushThresholdOf1[LaneCount];
+
+	double reciprocalOf0[LaneCount];
+	double reciprocalOf1[LaneCount];
+
+	void SetLane(int64_t lane, const BinaryRangeANSCoder& coder) {
+		totalFrequency[lane] = coder.GetTotalFrequency();
+		totalRangeBitWidth[lane] = coder.GetTotalRangeBitWidth();
+
+		frequencyOf0[lane] = coder.GetFrequencyOf(0);
+		frequencyOf1[lane] = coder.GetFrequencyOf(1);
+
+		flushThresholdOf0[lane] = frequencyOf0[lane] * 256;
+		flushThresholdOf1[lane] = frequencyOf1[lane] * 256;
+
+		reciprocalOf0[lane] = 1.0 / double(frequencyOf0[lane]);
+		reciprocalOf1[lane] = 1.0 / double(frequencyOf1[lane]);
+	}
+};
+
+// Selects between two values using a mask of all 1 bits or all 0 bits.
+//
+// Conditional expressions assigning back to the same array element (`x[i] = c ? y : x[i]`) are
+// often compiled as conditional stores, which prevents vectorization. Masking doesn't.
+inline uint32_t SelectByMask(uint32_t mask, uint32_t valueIfSet, uint32_t valueIfClear) {
+	return (valueIfSet & mask) | (valueIfClear & ~mask);
+}
+
+// Maximum number of bytes flushed (or read) for a single bit.
+//
+// States are below 2^31, and a state is only flushed while it's at least 256 times the symbol's
+// frequency (at least 1), so after 3 flushes, it's always below the threshold.
+inline constexpr int64_t maxRenormalizationByteCount = 3;
+
+// Number of steps encoded before the flushed bytes are compacted, bounding the scratch memory size
+inline constexpr int64_t stepsPerChunk = 256;
+
+// Reusable scratch memory for the lane encoder
+template <int64_t LaneCount>
+struct EncoderScratch {
+	// Symbols read by each lane, indexed by [step within chunk][lane]
+	std::vector<uint32_t> symbols = std::vector<uint32_t>(stepsPerChunk * LaneCount);
+
+	// Flushed bytes, indexed by [step within chunk][flush round][lane]
+	std::vector<uint8_t> flushedBytes = std::vector<uint8_t>(stepsPerChunk * maxRenormalizationByteCount * LaneCount);
+
+	// Number of bytes flushed by each lane, indexed by [step within chunk][lane]
+	std::vector<uint8_t> flushedByteCounts = std::vector<uint8_t>(stepsPerChunk * LaneCount);
+
+	// Whether any lane has flushed at each step (most steps don't flush at all)
+	std::vector<uint8_t> stepHasFlushes = std::vector<uint8_t>(stepsPerChunk);
+
+	// Flushed bytes of each lane, in encoding order (reversed)
+	std::vector<uint8_t> laneBytes[LaneCount];
+};
+
+// Encodes a group of up to `LaneCount` messages, and appends them to the batch.
+// `coders[i]` is the coder of `messages[i]`.
+template <int64_t LaneCount>
+void EncodeGroup(const BinaryRangeANSCoder* const* coders,
+				 BitArray* messages,
+				 int64_t messageCount,
+				 BinaryRangeANSEncodedBatch& batch,
+				 EncoderScratch<LaneCount>& scratch) {
+
+	LaneModels<LaneCount> models;
+
+	int64_t messageBitLengths[LaneCount];
+	int64_t maxMessageBitLength = 0;
+
+	uint32_t state[LaneCount];
+
+	// Unused lanes get the model of the first lane, and an empty message
+	for (int64_t lane = 0; lane < LaneCount; lane++) {
+		bool isUsed = lane < messageCount;
+
+		models.SetLane(lane, *coders[isUsed ? lane : 0]);
+
+		messageBitLengths[lane] = isUsed ? messages[lane].BitLength() : 0;
+		maxMessageBitLength = std::max(maxMessageBitLength, messageBitLengths[lane]);
+
+		state[lane] = models.totalFrequency[lane];
+
+		scratch.laneBytes[lane].clear();
+	}
+
+	uint32_t isActive[LaneCount];
+
+	for (int64_t chunkStartStep = 0; chunkStartStep < maxMessageBitLength; chunkStartStep += stepsPerChunk) {
+		int64_t chunkStepCount = std::min(stepsPerChunk, maxMessageBitLength - chunkStartStep);
+
+		// Read the symbols of the chunk. Messages are encoded in reverse order, so each lane reads its
+		// own message starting from its end, and lanes with shorter messages finish earlier.
+		for (int64_t lane = 0; lane < LaneCount; lane++) {
+			uint8_t* messageBytes = messages[lane < messageCount ? lane : 0].Data();
+
+			int64_t laneStepCount = std::clamp(messageBitLengths[lane] - chunkStartStep, int64_t(0), chunkStepCount);
+			uint64_t readPosition = uint64_t(messageBitLengths[lane] - 1 - chunkStartStep);
+
+			for (int64_t stepInChunk = 0; stepInChunk < laneStepCount; stepInChunk++) {
+				uint64_t position = readPosition - stepInChunk;
+
+				scratch.symbols[stepInChunk * LaneCount + lane] = (messageBytes[position / 8] >> (position % 8)) & 1;
+			}
+
+			for (int64_t stepInChunk = laneStepCount; stepInChunk < chunkStepCount; stepInChunk++) {
+				scratch.symbols[stepInChunk * LaneCount + lane] = 0;
+			}
+		}
+
+		for (int64_t stepInChunk = 0; stepInChunk < chunkStepCount; stepInChunk++) {
+			int64_t step = chunkStartStep + stepInChunk;
+
+			uint32_t* symbol = &scratch.symbols[stepInChunk * LaneCount];
+
+			for (int64_t lane = 0; lane < LaneCount; lane++) {
+				isActive[lane] = step < messageBitLengths[lane];
+			}
+
+			uint8_t* stepFlushedBytes = &scratch.flushedBytes[stepInChunk * maxRenormalizationByteCount * LaneCount];
+			uint8_t* stepFlushedByteCounts = &scratch.flushedByteCounts[stepInChunk * LaneCount];
+
+			for (int64_t lane = 0; lane < LaneCount; lane++) {
+				stepFlushedByteCounts[lane] = 0;
+			}
+
+			// Flush, in masked rounds. Stops once no lane needs another round, which is almost always
+			// after the first one (so the branch is well predicted).
+			for (int64_t round = 0; round < maxRenormalizationByteCount; round++) {
+				uint8_t* roundFlushedBytes = stepFlushedBytes + (round * LaneCount);
+
+				uint32_t hasAnyLaneFlushed = 0;
+				uint32_t needsAnotherRound = 0;
+
+				for (int64_t lane = 0; lane < LaneCount; lane++) {
+					uint32_t currentState = state[lane];
+					uint32_t symbolMask = 0u - symbol[lane];
+
+					uint32_t flushThreshold = SelectByMask(symbolMask, models.flushThresholdOf1[lane], models.flushThresholdOf0[lane]);
+					uint32_t shouldFlush = isActive[lane] & (currentState >= flushThreshold);
+
+					roundFlushedBytes[lane] = uint8_t(currentState);
+					stepFlushedByteCounts[lane] += uint8_t(shouldFlush);
+
+					uint32_t newState = SelectByMask(0u - shouldFlush, currentState >> 8, currentState);
+
+					state[lane] = newState;
+
+					hasAnyLaneFlushed |= shouldFlush;
+					needsAnotherRound |= isActive[lane] & (newState >= flushThreshold);
+				}
+
+				if (round == 0) {
+					scratch.stepHasFlushes[stepInChunk] = uint8_t(hasAnyLaneFlushed);
+				}
+
+				if (!needsAnotherRound) {
+					break;
+				}
+			}
+
+			// State transition
+			for (int64_t lane = 0; lane < LaneCount; lane++) {
+				uint32_t currentState = state[lane];
+				uint32_t symbolMask = 0u - symbol[lane];
+
+				uint32_t frequency = SelectByMask(symbolMask, models.frequencyOf1[lane], models.frequencyOf0[lane]);
+				uint32_t cumulativeFrequency = models.frequencyOf0[lane] & symbolMask;
+
+				// Both reciprocals are loaded before selecting, to keep the loop free of branches
+				double reciprocalOf0 = models.reciprocalOf0[lane];
+				double reciprocalOf1 = models.reciprocalOf1[lane];
+				double reciprocal = symbol[lane] ? reciprocalOf1 : reciprocalOf0;
+
+				// States are below 2^31, so signed conversions (which vectorize better) can be used
+				auto quotient = uint32_t(int32_t(double(int32_t(currentState)) * reciprocal));
+				uint32_t remainder = currentState - (quotient * frequency);
+
+				// Correct an underestimated quotient
+				uint32_t correction = remainder >= frequency;
+
+				quotient += correction;
+				remainder -= frequency & (0u - correction);
+
+				uint32_t newState = (quotient << models.totalRangeBitWidth[lane]) + cumulativeFrequency + remainder;
+
+				state[lane] = SelectByMask(0u - isActive[lane], newState, currentState);
+			}
+		}
+
+		// Compact the flushed bytes of each lane, skipping steps where no lane has flushed
+		uint8_t* laneBytesData[LaneCount];
+		int64_t laneByteCounts[LaneCount];
+
+		for (int64_t lane = 0; lane < messageCount; lane++) {
+			auto& laneBytes = scratch.laneBytes[lane];
+
+			laneByteCounts[lane] = laneBytes.size();
+			// Includes room for the unused bytes written past the end (see below)
+			laneBytes.resize(laneByteCounts[lane] + ((chunkStepCount + 1) * maxRenormalizationByteCount));
+
+			laneBytesData[lane] = laneBytes.data();
+		}
+
+		for (int64_t stepInChunk = 0; stepInChunk < chunkStepCount; stepInChunk++) {
+			if (!scratch.stepHasFlushes[stepInChunk]) {
+				continue;
+			}
+
+			uint8_t* stepFlushedBytes = &scratch.flushedBytes[stepInChunk * maxRenormalizationByteCount * LaneCount];
+			uint8_t* stepFlushedByteCounts = &scratch.flushedByteCounts[stepInChunk * LaneCount];
+
+			// All rounds are copied, but the lane's byte count only advances by the number of bytes
+			// it actually flushed, so the rest are overwritten later (or truncated)
+			for (int64_t lane = 0; lane < messageCount; lane++) {
+				uint8_t* laneOutput = laneBytesData[lane] + laneByteCounts[lane];
+
+				for (int64_t round = 0; round < maxRenormalizationByteCount; round++) {
+					laneOutput[round] = stepFlushedBytes[round * LaneCount + lane];
+				}
+
+				laneByteCounts[lane] += stepFlushedByteCounts[lane];
+			}
+		}
+
+		for (int64_t lane = 0; lane < messageCount; lane++) {
+			scratch.laneBytes[lane].resize(laneByteCounts[lane]);
+		}
+	}
+
+	// Append the messages to the batch, in order
+	for (int64_t lane = 0; lane < messageCount; lane++) {
+		auto& laneBytes = scratch.laneBytes[lane];
+
+		batch.byteOffsets.push_back(batch.encodedBytes.size());
+		batch.finalStates.push_back(state[lane]);
+
+		batch.encodedBytes.insert(batch.encodedBytes.end(), laneBytes.rbegin(), laneBytes.rend());
+	}
+}
+
+// Encode a batch of messages, `LaneCount` messages at a time. `coders[i]` is the coder of `messages[i]`.
+// The batch is cleared first. The result is identical to `BinaryRangeANSCoder::EncodeBatch`.
+template <int64_t LaneCount = 16>
+void EncodeBatch(const BinaryRangeANSCoder* const* coders,
+				 BitArray* messages,
+				 int64_t messageCount,
+				 BinaryRangeANSEncodedBatch& batch) {
+
+	batch.Clear();
+
+	batch.byteOffsets.reserve(messageCount + 1);
+	batch.finalStates.reserve(messageCount);
+
+	EncoderScratch<LaneCount> scratch;
+
+	for (int64_t groupStart = 0; groupStart < messageCount; groupStart += LaneCount) {
+		int64_t groupMessageCount = std::min(LaneCount, messageCount - groupStart);
+
+		EncodeGroup<LaneCount>(coders + groupStart, messages + groupStart, groupMessageCount, batch, scratch);
+	}
+
+	batch.byteOffsets.push_back(batch.encodedBytes.size());
+}
+
+// Encode a batch of messages, all using the same coder
+template <int64_t LaneCount = 16>
+void EncodeBatch(const BinaryRangeANSCoder& coder,
+				 std::vector<BitArray>& messages,
+				 BinaryRangeANSEncodedBatch& batch) {
+
+	std::vector<const BinaryRangeANSCoder*> coders(messages.size(), &coder);
+
+	EncodeBatch<LaneCount>(coders.data(), messages.data(), int64_t(messages.size()), batch);
+}
+
+// Decodes a group of up to `LaneCount` messages of the batch, starting at the given message index
+template <int64_t LaneCount>
+void DecodeGroup(const BinaryRangeANSCoder* const* coders,
+				 BinaryRangeANSEncodedBatch& batch,
+				 int64_t groupStart,
+				 int64_t messageCount,
+				 BitArray* outputBitArrays) {
+
+	LaneModels<LaneCount> models;
+
+	uint8_t* encodedBytes[LaneCount];
+	int64_t encodedByteLengths[LaneCount];
+	int64_t readPositions[LaneCount];
+
+	int64_t messageBitLengths[LaneCount];
+	int64_t maxMessageBitLength = 0;
+
+	uint32_t state[LaneCount];
+
+	for (int64_t lane = 0; lane < LaneCount; lane++) {
+		bool isUsed = lane < messageCount;
+		int64_t messageIndex = groupStart + (isUsed ? lane : 0);
+
+		models.SetLane(lane, *coders[isUsed ? lane : 0]);
+
+		encodedBytes[lane] = batch.encodedBytes.data() + batch.byteOffsets[messageIndex];
+		encodedByteLengths[lane] = isUsed ? int64_t(batch.byteOffsets[messageIndex + 1] - batch.byteOffsets[messageIndex]) : 0;
+		readPositions[lane] = 0;
+
+		messageBitLengths[lane] = isUsed ? outputBitArrays[lane].BitLength() : 0;
+		maxMessageBitLength = std::max(maxMessageBitLength, messageBitLengths[lane]);
+
+		state[lane] = batch.finalStates[messageIndex];
+	}
+
+	uint32_t symbol[LaneCount];
+	uint32_t isActive[LaneCount];
+
+	for (int64_t step = 0; step < maxMessageBitLength; step++) {
+		for (int64_t lane = 0; lane < LaneCount; lane++) {
+			isActive[lane] = step < messageBitLengths[lane];
+		}
+
+		// Read bytes into the state, in a fixed number of masked rounds
+		for (int64_t round = 0; round < maxRenormalizationByteCount; round++) {
+			for (int64_t lane = 0; lane < LaneCount; lane++) {
+				bool shouldRead = isActive[lane] && state[lane] < models.totalFrequency[lane] && readPositions[lane] < encodedByteLengths[lane];
+
+				uint32_t byte = shouldRead ? encodedBytes[lane][readPositions[lane]] : 0;
+
+				state[lane] = shouldRead ? (state[lane] << 8) | byte : state[lane];
+				readPositions[lane] += shouldRead;
+			}
+		}
+
+		// State transition
+		for (int64_t lane = 0; lane < LaneCount; lane++) {
+			uint32_t currentState = state[lane];
+
+			uint32_t quotient = currentState >> models.totalRangeBitWidth[lane];
+			uint32_t remainder = currentState & (models.totalFrequency[lane] - 1);
+
+			symbol[lane] = remainder >= models.frequencyOf0[lane];
+
+			uint32_t symbolMask = 0u - symbol[lane];
+
+			uint32_t frequency = SelectByMask(symbolMask, models.frequencyOf1[lane], models.frequencyOf0[lane]);
+			uint32_t cumulativeFrequency = models.frequencyOf0[lane] & symbolMask;
+
+			uint32_t newState = (frequency * quotient) - cumulativeFrequency + remainder;
+
+			state[lane] = SelectByMask(0u - isActive[lane], newState, currentState);
+		}
+
+		for (int64_t lane = 0; lane < messageCount; lane++) {
+			if (isActive[lane]) {
+				outputBitArrays[lane].WriteBitAt(step, uint8_t(symbol[lane]));
+			}
+		}
+	}
+}
+
+// Decode a batch of messages, `LaneCount` messages at a time. `coders[i]` is the coder of message `i`.
+// Each output bit array should be pre-sized (and zeroed) to the length of the corresponding message.
+//
+// Expects a valid encoding (like the one produced by the encoders). For any valid encoding, the result
+// is identical to `BinaryRangeANSCoder::DecodeBatch`.
+template <int64_t LaneCount = 16>
+void DecodeBatch(const BinaryRangeANSCoder* const* coders,
+				 BinaryRangeANSEncodedBatch& batch,
+				 BitArray* outputBitArrays,
+				 int64_t outputBitArrayCount) {
+
+	if (outputBitArrayCount != batch.MessageCount()) {
+		throw std::exception("Output bit array count doesn't match the batch message count.");
+	}
+
+	for (int64_t groupStart = 0; groupStart < outputBitArrayCount; groupStart += LaneCount) {
+		int64_t groupMessageCount = std::min(LaneCount, outputBitArrayCount - groupStart);
+
+		DecodeGroup<LaneCount>(coders + groupStart, batch, groupStart, groupMessageCount, outputBitArrays + groupStart);
+	}
+}
+
+// Decode a batch of messages, all using the same coder
+template <int64_t LaneCount = 16>
+void DecodeBatch(const BinaryRangeANSCoder& coder,
+				 BinaryRangeANSEncodedBatch& batch,
+				 std::vector<BitArray>& outputBitArrays) {
+
+	std::vector<const BinaryRangeANSCoder*> coders(outputBitArrays.size(), &coder);
+
+	DecodeBatch<LaneCount>(coders.data(), batch, outputBitArrays.data(), int64_t(outputBitArrays.size()));
+}
+
+}  // namespace BinaryRangeANSLanes
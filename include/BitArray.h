@@ -1,6 +1,9 @@
 #pragma once
 
+#include "Utilities.h"
+
 #include <cstdint>
+#include <cstring>
 
 class BitArray {
    private:
@@ -27,6 +30,101 @@ class BitArray {
 		bytes[byteIndex] |= bitValue << bitIndexInByte;
 	}
 
+	// Reads `bitCount` bits (at most 32) starting at the given position, the first one as the
+	// least significant bit of the result
+	inline uint32_t ReadBitsAt(int64_t bitReadPosition, int bitCount) {
+		auto firstByteIndex = bitReadPosition / 8;
+		auto lastByteIndex = (bitReadPosition + bitCount - 1) / 8;
+
+		uint64_t word = 0;
+
+		for (auto byteIndex = firstByteIndex; byteIndex <= lastByteIndex; byteIndex++) {
+			word |= uint64_t(bytes[byteIndex]) << ((byteIndex - firstByteIndex) * 8);
+		}
+
+		return uint32_t((word >> (bitReadPosition % 8)) & ((1ULL << bitCount) - 1));
+	}
+
+	// Writes the lowest `bitCount` bits (at most 32) of `bits`, starting at the given position,
+	// the least significant bit first. Like `WriteBitAt`, the bits are ORed into the existing ones.
+	inline void WriteBitsAt(int64_t bitWritePosition, uint32_t bits, int bitCount) {
+		auto firstByteIndex = bitWritePosition / 8;
+		auto lastByteIndex = (bitWritePosition + bitCount - 1) / 8;
+
+		uint64_t word = uint64_t(bits & ((1ULL << bitCount) - 1)) << (bitWritePosition % 8);
+
+		for (auto byteIndex = firstByteIndex; byteIndex <= lastByteIndex; byteIndex++) {
+			bytes[byteIndex] |= uint8_t(word >> ((byteIndex - firstByteIndex) * 8));
+		}
+	}
+
+	// Counts the 1 bits in the range [startPosition, endPosition)
+	int64_t CountOnesInRange(int64_t startPosition, int64_t endPosition) {
+		int64_t count = 0;
+		int64_t position = startPosition;
+
+		// Count bits one by one, until reaching a byte boundary
+		while (position < endPosition && position % 8 != 0) {
+			count += ReadBitAt(position++);
+		}
+
+		// Count 64 bits at a time. Written as a simple counted loop over the words, so the compiler can
+		// vectorize it (when targeting a CPU with vector popcount instructions, like AVX-512 VPOPCNTDQ).
+		int64_t wordCount = (endPosition - position) / 64;
+		const uint8_t* wordBytes = bytes + (position / 8);
+
+		for (int64_t wordIndex = 0; wordIndex < wordCount; wordIndex++) {
+			uint64_t word;
+			std::memcpy(&word, wordBytes + (wordIndex * 8), sizeof(word));
+
+			count += EntropyCodingUtilities::popcount64(word);
+		}
+
+		position += wordCount * 64;
+
+		// Count remaining bits one by one
+		while (position < endPosition) {
+			count += ReadBitAt(position++);
+		}
+
+		return count;
+	}
+
+	// Finds the position of the first 1 bit at or after the given position.
+	// Returns the bit length if there is none.
+	int64_t FindNextSetBit(int64_t position) {
+		// Check bits one by one, until reaching a byte boundary
+		while (position < bitLength && position % 8 != 0) {
+			if (ReadBitAt(position)) {
+				return position;
+			}
+
+			position++;
+		}
+
+		// Check 64 bits at a time. Loaded as little-endian, the first bit is the least significant one.
+		while (position + 64 <= bitLength) {
+			uint64_t word = EntropyCodingUtilities::loadLittleEndian64(bytes + (position / 8));
+
+			if (word != 0) {
+				return position + EntropyCodingUtilities::countTrailingZeros64(word);
+			}
+
+			position += 64;
+		}
+
+		// Check remaining bits one by one
+		while (position < bitLength) {
+			if (ReadBitAt(position)) {
+				return position;
+			}
+
+			position++;
+		}
+
+		return bitLength;
+	}
+
 	int64_t BitLength() { return bitLength; }
 
 	int64_t ByteLength() { return (bitLength + 7) / 8; }
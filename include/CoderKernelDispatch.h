@@ -0,0 +1,214 @@
+#pragma once
+
+#include "BitArray.h"
+#include "OutputBitStream.h"
+#include "BinaryArithmeticCoder.h"
+#include "BinaryRangeANSCoder.h"
+#include "BinaryRangeANSLanes.h"
+#include "CpuFeatures.h"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Runtime dispatch of the coder kernels, based on the features of the current CPU.
+//
+// The same kernel source code is compiled several times, each time targeting a different
+// instruction set level (using the `target` function attribute), and the fastest level supported
+// by the current CPU is bound once, on first use. This allows a single build to use extensions
+// like BMI2 (`shrx`, `mulx`), LZCNT and AVX2 / AVX-512 (for auto-vectorized loops, like the table
+// construction loops and the lane-parallel batch kernels) where available, while still running on
+// older CPUs.
+//
+// Per-function targets are only supported by GCC and Clang on x86. On other compilers and
+// platforms, only the generic kernels are available.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace CoderKernelDispatch {
+
+enum class KernelLevel : uint8_t {
+	// Baseline instruction set
+	Generic = 0,
+
+	// BMI1, BMI2 and LZCNT
+	BMI2 = 1,
+
+	// SSE4.2, POPCNT, AVX2, BMI1, BMI2 and LZCNT
+	AVX2 = 2,
+
+	// All of the above, and AVX-512 (F, BW and VL)
+	AVX512 = 3,
+};
+
+struct CoderKernels {
+	KernelLevel level;
+
+	// Binary rANS kernels
+	uint32_t (*rangeANSEncode)(const BinaryRangeANSCoder& coder, BitArray& inputBitArray, std::vector<uint8_t>& outputBytes);
+	void (*rangeANSDecode)(const BinaryRangeANSCoder& coder, uint8_t* encodedBytes, int64_t encodedByteLength, uint32_t state, BitArray& outputBitArray);
+	uint32_t (*rangeANSEncodeUsingTable)(const BinaryRangeANSCoder& coder, BitArray& inputBitArray, std::vector<uint8_t>& outputBytes);
+	void (*rangeANSDecodeUsingTable)(const BinaryRangeANSCoder& coder, uint8_t* encodedBytes, int64_t encodedByteLength, uint32_t state, BitArray& outputBitArray);
+	void (*rangeANSBuildEncoderTable)(const BinaryRangeANSCoder& coder);
+	void (*rangeANSBuildDecoderTable)(const BinaryRangeANSCoder& coder);
+
+	// Lane-parallel binary rANS batch kernels (see `BinaryRangeANSLanes`), using the default lane count
+	void (*rangeANSEncodeLanes)(const BinaryRangeANSCoder* const* coders, BitArray* messages, int64_t messageCount, BinaryRangeANSEncodedBatch& batch);
+	void (*rangeANSDecodeLanes)(const BinaryRangeANSCoder* const* coders, BinaryRangeANSEncodedBatch& batch, BitArray* outputBitArrays, int64_t outputBitArrayCount);
+
+	// Binary arithmetic coder kernels
+	void (*arithmeticEncode)(BitArray& inputBitArray, OutputBitStream& outputBitStream, double probabilityOf1);
+	void (*arithmeticDecode)(BitArray& inputBitArray, BitArray& outputBitArray, double probabilityOf1);
+};
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ENTROPY_CODING_HAS_TARGET_KERNELS 1
+
+// `flatten` inlines the coder methods into the kernel, so they are compiled for its target
+#define ENTROPY_CODING_KERNEL_ATTRIBUTES(targets) __attribute__((target(targets), flatten))
+#else
+#define ENTROPY_CODING_HAS_TARGET_KERNELS 0
+#define ENTROPY_CODING_KERNEL_ATTRIBUTES(targets)
+#endif
+
+// Defines the set of kernels for a single instruction set level, within the given namespace
+#define ENTROPY_CODING_DEFINE_KERNELS(KernelNamespace, Level, KernelAttributes)                                               \
+	namespace KernelNamespace {                                                                                             \
+	KernelAttributes inline uint32_t RangeANSEncode(const BinaryRangeANSCoder& coder, BitArray& inputBitArray,              \
+													std::vector<uint8_t>& outputBytes) {                                    \
+		return coder.Encode(inputBitArray, outputBytes);                                                                    \
+	}                                                                                                                       \
+	KernelAttributes inline void RangeANSDecode(const BinaryRangeANSCoder& coder, uint8_t* encodedBytes,                    \
+												int64_t encodedByteLength, uint32_t state, BitArray& outputBitArray) {      \
+		coder.Decode(encodedBytes, encodedByteLength, state, outputBitArray);                                               \
+	}                                                                                                                       \
+	KernelAttributes inline uint32_t RangeANSEncodeUsingTable(const BinaryRangeANSCoder& coder, BitArray& inputBitArray,    \
+															  std::vector<uint8_t>& outputBytes) {                          \
+		return coder.EncodeUsingTable(inputBitArray, outputBytes);                                                          \
+	}                                                                                                                       \
+	KernelAttributes inline void RangeANSDecodeUsingTable(const BinaryRangeANSCoder& coder, uint8_t* encodedBytes,          \
+														  int64_t encodedByteLength, uint32_t state,                        \
+														  BitArray& outputBitArray) {                                       \
+		coder.DecodeUsingTable(encodedBytes, encodedByteLength, state, outputBitArray);                                     \
+	}                                                                                                                       \
+	KernelAttributes inline void RangeANSBuildEncoderTable(const BinaryRangeANSCoder& coder) {                              \
+		coder.BuildEncoderStateTransitionTable();                                                                           \
+	}                                                                                                                       \
+	KernelAttributes inline void RangeANSBuildDecoderTable(const BinaryRangeANSCoder& coder) {                              \
+		coder.BuildDecoderStateTransitionTable();                                                                           \
+	}                                                                                                                       \
+	KernelAttributes inline void RangeANSEncodeLanes(const BinaryRangeANSCoder* const* coders, BitArray* messages,          \
+													 int64_t messageCount, BinaryRangeANSEncodedBatch& batch) {             \
+		BinaryRangeANSLanes::EncodeBatch(coders, messages, messageCount, batch);                                            \
+	}                                                                                                                       \
+	KernelAttributes inline void RangeANSDecodeLanes(const BinaryRangeANSCoder* const* coders,                              \
+													 BinaryRangeANSEncodedBatch& batch, BitArray* outputBitArrays,          \
+													 int64_t outputBitArrayCount) {                                         \
+		BinaryRangeANSLanes::DecodeBatch(coders, batch, outputBitArrays, outputBitArrayCount);                              \
+	}                                                                                                                       \
+	KernelAttributes inline void ArithmeticEncode(BitArray& inputBitArray, OutputBitStream& outputBitStream,                \
+												  double probabilityOf1) {                                                  \
+		BinaryArithmeticCoder::Encode(inputBitArray, outputBitStream, probabilityOf1);                                      \
+	}                                                                                                                       \
+	KernelAttributes inline void ArithmeticDecode(BitArray& inputBitArray, BitArray& outputBitArray,                        \
+												  double probabilityOf1) {                                                  \
+		BinaryArithmeticCoder::Decode(inputBitArray, outputBitArray, probabilityOf1);                                       \
+	}                                                                                                                       \
+	inline constexpr CoderKernels kernels = {                                                                               \
+		KernelLevel::Level, RangeANSEncode, RangeANSDecode, RangeANSEncodeUsingTable, RangeANSDecodeUsingTable,             \
+		RangeANSBuildEncoderTable, RangeANSBuildDecoderTable, RangeANSEncodeLanes, RangeANSDecodeLanes,                     \
+		ArithmeticEncode, ArithmeticDecode,                                                                                 \
+	};                                                                                                                      \
+	}
+
+ENTROPY_CODING_DEFINE_KERNELS(GenericKernels, Generic, )
+
+#if ENTROPY_CODING_HAS_TARGET_KERNELS
+ENTROPY_CODING_DEFINE_KERNELS(BMI2Kernels, BMI2, ENTROPY_CODING_KERNEL_ATTRIBUTES("bmi,bmi2,lzcnt"))
+ENTROPY_CODING_DEFINE_KERNELS(AVX2Kernels, AVX2, ENTROPY_CODING_KERNEL_ATTRIBUTES("sse4.2,popcnt,avx2,bmi,bmi2,lzcnt"))
+ENTROPY_CODING_DEFINE_KERNELS(AVX512Kernels, AVX512, ENTROPY_CODING_KERNEL_ATTRIBUTES("sse4.2,popcnt,avx2,avx512f,avx512bw,avx512vl,bmi,bmi2,lzcnt"))
+#endif
+
+// Checks if the kernels of the given level can run on a CPU with the given features
+inline bool IsKernelLevelSupportedBy(KernelLevel level, const CpuFeatures::FeatureSet& features) {
+	bool supportsBMI2 = features.bmi1 && features.bmi2 && features.lzcnt;
+	bool supportsAVX2 = supportsBMI2 && features.sse42 && features.popcnt && features.avx2;
+	bool supportsAVX512 = supportsAVX2 && features.avx512f && features.avx512bw && features.avx512vl;
+
+	switch (level) {
+		case KernelLevel::Generic:
+			return true;
+		case KernelLevel::BMI2:
+			return ENTROPY_CODING_HAS_TARGET_KERNELS && supportsBMI2;
+		case KernelLevel::AVX2:
+			return ENTROPY_CODING_HAS_TARGET_KERNELS && supportsAVX2;
+		case KernelLevel::AVX512:
+			return ENTROPY_CODING_HAS_TARGET_KERNELS && supportsAVX512;
+		default:
+			return false;
+	}
+}
+
+// Selects the highest kernel level supported by a CPU with the given features
+inline KernelLevel SelectKernelLevel(const CpuFeatures::FeatureSet& features) {
+	for (auto level : { KernelLevel::AVX512, KernelLevel::AVX2, KernelLevel::BMI2 }) {
+		if (IsKernelLevelSupportedBy(level, features)) {
+			return level;
+		}
+	}
+
+	return KernelLevel::Generic;
+}
+
+// Gets the kernels of the given level. Doesn't check if the current CPU supports them.
+inline const CoderKernels& GetKernelsFor(KernelLevel level) {
+#if ENTROPY_CODING_HAS_TARGET_KERNELS
+	switch (level) {
+		case KernelLevel::BMI2:
+			return BMI2Kernels::kernels;
+		case KernelLevel::AVX2:
+			return AVX2Kernels::kernels;
+		case KernelLevel::AVX512:
+			return AVX512Kernels::kernels;
+		default:
+			break;
+	}
+#endif
+
+	return GenericKernels::kernels;
+}
+
+// The currently bound kernels. Bound to the best kernels for the current CPU on first use.
+inline std::atomic<const CoderKernels*>& BoundKernels() {
+	static std::atomic<const CoderKernels*> boundKernels { &GetKernelsFor(SelectKernelLevel(CpuFeatures::GetDetectedFeatures())) };
+
+	return boundKernels;
+}
+
+// Gets the currently bound kernels.
+//
+// Calls through the returned function pointers are cheap, but to avoid repeated atomic loads in
+// tight loops, the returned reference can be kept and reused.
+inline const CoderKernels& GetKernels() {
+	return *BoundKernels().load(std::memory_order_acquire);
+}
+
+// Binds the kernels of the given level, overriding the automatic selection.
+//
+// Intended for testing and benchmarking. Throws if the current CPU doesn't support the level.
+inline void OverrideKernelLevel(KernelLevel level) {
+	if (!IsKernelLevelSupportedBy(level, CpuFeatures::GetDetectedFeatures())) {
+		throw std::exception("Kernel level is not supported by the current CPU.");
+	}
+
+	BoundKernels().store(&GetKernelsFor(level), std::memory_order_release);
+}
+
+// Restores the automatic kernel selection
+inline void ClearKernelLevelOverride() {
+	auto level = SelectKernelLevel(CpuFeatures::GetDetectedFeatures());
+
+	BoundKernels().store(&GetKernelsFor(level), std::memory_order_release);
+}
+
+}  // namespace CoderKernelDispatch
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "BitArray.h"
+#include "OutputBitStream.h"
+
+#include <cstdint>
+#include <vector>
+
+// Reusable buffers for encoding and decoding.
+//
+// Allocating new output buffers for every call adds allocator overhead (and contention, when
+// many threads encode concurrently). A workspace keeps its buffers between calls: `Reset` clears
+// them without releasing their memory, so once the buffers have grown to fit the largest message,
+// encoding and decoding don't allocate at all.
+//
+// A workspace must not be used by multiple threads at the same time. Use `ForCurrentThread`
+// to get a separate workspace for each thread.
+//
+// Usage:
+//
+//   auto& workspace = CoderWorkspace::ForCurrentThread();
+//   workspace.Reset();
+//
+//   auto finalState = coder.Encode(inputBitArray, workspace.EncodedBytes());
+//
+// Buffer contents are only valid until the next `Reset`.
+class CoderWorkspace {
+   private:
+	std::vector<uint8_t> encodedBytes;
+	OutputBitStream encodedBitStream;
+	std::vector<uint8_t> decodedBytes;
+
+   public:
+	CoderWorkspace(int64_t initialByteCapacity = 0)
+		: encodedBitStream(initialByteCapacity * 8) {
+
+		encodedBytes.reserve(initialByteCapacity);
+		decodedBytes.reserve(initialByteCapacity);
+	}
+
+	// Clears all buffers, keeping their allocated capacity
+	void Reset() {
+		encodedBytes.clear();
+		encodedBitStream.Reset();
+		decodedBytes.clear();
+	}
+
+	// Byte buffer for encoded rANS output (empty after reset)
+	std::vector<uint8_t>& EncodedBytes() { return encodedBytes; }
+
+	// Bit stream for encoded arithmetic coder output (empty after reset)
+	OutputBitStream& EncodedBitStream() { return encodedBitStream; }
+
+	// Gets a zeroed bit array of the given length, to decode into.
+	// Invalidates bit arrays previously returned by this method.
+	BitArray DecodedBitArray(int64_t bitLength) {
+		decodedBytes.assign((bitLength + 7) / 8, 0);
+
+		return BitArray(decodedBytes.data(), bitLength);
+	}
+
+	// Releases the memory held by the buffers
+	void ReleaseMemory() {
+		encodedBytes = std::vector<uint8_t>();
+		encodedBitStream = OutputBitStream(0);
+		decodedBytes = std::vector<uint8_t>();
+	}
+
+	// Gets the workspace of the current thread. Created on first use, and destroyed when the thread exits.
+	static CoderWorkspace& ForCurrentThread() {
+		thread_local CoderWorkspace workspace;
+
+		return workspace;
+	}
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "BitArray.h"
+#include "BinaryRangeANSCoder.h"
+#include "Utilities.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+// Entropy-coded bit vector, supporting access, rank and select queries.
+//
+// The bits are split into fixed-size blocks, each encoded independently using binary rANS.
+// Blocks are grouped into superblocks. For each superblock, the count of 1 bits before it is
+// stored, and for each block, the count of 1 bits before it within its superblock.
+//
+// Each query decodes at most one block. Recently decoded blocks are kept in a small
+// direct-mapped cache, so repeated queries to the same region don't decode again.
+//
+// Queries update the cache, so a single instance shouldn't be queried from multiple threads
+// at the same time.
+class CompressedBitVector {
+   private:
+	struct CachedBlock {
+		int64_t blockNumber = -1;
+		std::vector<uint8_t> bytes;
+	};
+
+	BinaryRangeANSCoder coder;
+
+	int64_t bitLength;
+	int64_t blockBitLength;
+	int64_t blocksPerSuperblock;
+	int64_t blockCount;
+	int64_t totalOneCount;
+
+	// Encoded blocks, stored consecutively
+	std::vector<uint8_t> encodedBytes;
+
+	// Offset of each block's encoded bytes (with an extra entry for the end offset)
+	std::vector<uint64_t> blockByteOffsets;
+
+	// Final encoder state of each block
+	std::vector<uint32_t> blockFinalStates;
+
+	// Count of 1 bits before each superblock
+	std::vector<uint64_t> superblockRanks;
+
+	// Count of 1 bits before each block, relative to the start of its superblock
+	std::vector<uint32_t> blockRanks;
+
+	// Direct-mapped cache of decoded blocks
+	std::vector<CachedBlock> cache;
+
+   public:
+	// Encodes the given bits.
+	//
+	// Block bit length must be a multiple of 64. Smaller blocks make queries faster,
+	// but add per-block overhead (final state, offset and rank), and reduce compression.
+	CompressedBitVector(BitArray& bitArray,
+						const BinaryRangeANSCoder& coder,
+						int64_t blockBitLength = 4096,
+						int64_t blocksPerSuperblock = 16,
+						int64_t cacheSize = 8)
+		: coder(coder) {
+
+		if (blockBitLength < 64 || blockBitLength % 64 != 0) {
+			throw std::exception("Block bit length must be a positive multiple of 64.");
+		}
+
+		if (blocksPerSuperblock < 1 || blockBitLength * blocksPerSuperblock > (1LL << 32)) {
+			throw std::exception("Superblock bit length must be between 1 block and 2^32 bits.");
+		}
+
+		if (cacheSize < 1) {
+			throw std::exception("Cache size must be at least 1.");
+		}
+
+		this->bitLength = bitArray.BitLength();
+		this->blockBitLength = blockBitLength;
+		this->blocksPerSuperblock = blocksPerSuperblock;
+		this->blockCount = (bitLength + blockBitLength - 1) / blockBitLength;
+
+		blockByteOffsets.reserve(blockCount + 1);
+		blockFinalStates.reserve(blockCount);
+		blockRanks.reserve(blockCount);
+		superblockRanks.reserve((blockCount + blocksPerSuperblock - 1) / blocksPerSuperblock);
+
+		uint64_t oneCount = 0;
+		uint64_t superblockStartOneCount = 0;
+
+		for (int64_t blockNumber = 0; blockNumber < blockCount; blockNumber++) {
+			int64_t blockStart = blockNumber * blockBitLength;
+			int64_t blockLength = std::min(blockBitLength, bitLength - blockStart);
+
+			if (blockNumber % blocksPerSuperblock == 0) {
+				superblockRanks.push_back(oneCount);
+				superblockStartOneCount = oneCount;
+			}
+
+			blockRanks.push_back(uint32_t(oneCount - superblockStartOneCount));
+
+			// Encode the block
+			BitArray blockBitArray(bitArray.Data() + (blockStart / 8), blockLength);
+
+			blockByteOffsets.push_back(encodedBytes.size());
+			blockFinalStates.push_back(this->coder.Encode(blockBitArray, encodedBytes));
+
+			oneCount += blockBitArray.CountOnesInRange(0, blockLength);
+		}
+
+		blockByteOffsets.push_back(encodedBytes.size());
+
+		totalOneCount = int64_t(oneCount);
+
+		cache.resize(cacheSize);
+	}
+
+	// Gets the bit at the given position
+	uint8_t Access(int64_t position) {
+		if (position < 0 || position >= bitLength) {
+			throw std::exception("Position is out of range.");
+		}
+
+		auto blockBitArray = GetDecodedBlock(position / blockBitLength);
+
+		return blockBitArray.ReadBitAt(position % blockBitLength);
+	}
+
+	// Counts the 1 bits before the given position (in the range [0, position))
+	int64_t Rank1(int64_t position) {
+		if (position < 0 || position > bitLength) {
+			throw std::exception("Position is out of range.");
+		}
+
+		if (position == bitLength) {
+			return totalOneCount;
+		}
+
+		int64_t blockNumber = position / blockBitLength;
+
+		int64_t rank = int64_t(superblockRanks[blockNumber / blocksPerSuperblock]) + blockRanks[blockNumber];
+
+		auto blockBitArray = GetDecodedBlock(blockNumber);
+
+		return rank + blockBitArray.CountOnesInRange(0, position % blockBitLength);
+	}
+
+	// Counts the 0 bits before the given position (in the range [0, position))
+	int64_t Rank0(int64_t position) {
+		return position - Rank1(position);
+	}
+
+	// Finds the position of the 1 bit with the given (zero-based) index.
+	// Returns -1 if there are not enough 1 bits.
+	int64_t Select1(int64_t oneIndex) {
+		if (oneIndex < 0 || oneIndex >= totalOneCount) {
+			return -1;
+		}
+
+		// Find the last superblock starting with at most `oneIndex` 1 bits before it
+		auto superblockIterator = std::upper_bound(superblockRanks.begin(), superblockRanks.end(), uint64_t(oneIndex)) - 1;
+		int64_t superblockNumber = superblockIterator - superblockRanks.begin();
+
+		// Find the last block within the superblock, starting with at most `oneIndex` 1 bits before it
+		uint64_t remainingOneCount = uint64_t(oneIndex) - *superblockIterator;
+
+		auto superblockBlockRanksStart = blockRanks.begin() + (superblockNumber * blocksPerSuperblock);
+		auto superblockBlockRanksEnd = blockRanks.begin() + std::min((superblockNumber + 1) * blocksPerSuperblock, blockCount);
+
+		auto blockIterator = std::upper_bound(superblockBlockRanksStart, superblockBlockRanksEnd, uint32_t(remainingOneCount)) - 1;
+		int64_t blockNumber = blockIterator - blockRanks.begin();
+
+		remainingOneCount -= *blockIterator;
+
+		// Scan the decoded block, 64 bits at a time, then bit by bit
+		auto blockBitArray = GetDecodedBlock(blockNumber);
+		int64_t blockLength = blockBitArray.BitLength();
+
+		int64_t position = 0;
+
+		while (blockLength - position >= 64) {
+			auto wordOneCount = uint64_t(blockBitArray.CountOnesInRange(position, position + 64));
+
+			if (wordOneCount > remainingOneCount) {
+				break;
+			}
+
+			remainingOneCount -= wordOneCount;
+			position += 64;
+		}
+
+		while (position < blockLength) {
+			if (blockBitArray.ReadBitAt(position) == 1) {
+				if (remainingOneCount == 0) {
+					return (blockNumber * blockBitLength) + position;
+				}
+
+				remainingOneCount -= 1;
+			}
+
+			position += 1;
+		}
+
+		return -1;
+	}
+
+	// Total number of bits
+	int64_t BitLength() { return bitLength; }
+
+	// Total number of 1 bits
+	int64_t OneCount() { return totalOneCount; }
+
+	// Total size of the encoded blocks, in bytes
+	int64_t EncodedByteLength() { return int64_t(encodedBytes.size()); }
+
+	// Total memory used by the encoded blocks and the index, in bytes (excluding the cache)
+	int64_t MemorySize() {
+		return int64_t(encodedBytes.size()) +
+			   int64_t(blockByteOffsets.size() * sizeof(uint64_t)) +
+			   int64_t(blockFinalStates.size() * sizeof(uint32_t)) +
+			   int64_t(superblockRanks.size() * sizeof(uint64_t)) +
+			   int64_t(blockRanks.size() * sizeof(uint32_t));
+	}
+
+   private:
+	// Gets a decoded block, decoding it if it isn't in the cache
+	BitArray GetDecodedBlock(int64_t blockNumber) {
+		int64_t blockLength = std::min(blockBitLength, bitLength - (blockNumber * blockBitLength));
+
+		auto& cachedBlock = cache[blockNumber % cache.size()];
+
+		if (cachedBlock.blockNumber != blockNumber) {
+			// The decoder only sets 1 bits, so the block has to be zeroed first
+			cachedBlock.bytes.assign(blockBitLength / 8, 0);
+			cachedBlock.blockNumber = blockNumber;
+
+			BitArray blockBitArray(cachedBlock.bytes.data(), blockLength);
+
+			uint64_t encodedByteOffset = blockByteOffsets[blockNumber];
+			uint64_t encodedByteLength = blockByteOffsets[blockNumber + 1] - encodedByteOffset;
+
+			coder.Decode(encodedBytes.data() + encodedByteOffset, encodedByteLength, blockFinalStates[blockNumber], blockBitArray);
+		}
+
+		return BitArray(cachedBlock.bytes.data(), blockLength);
+	}
+};
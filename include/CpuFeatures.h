@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Detection of CPU instruction set extensions relevant to the coder kernels.
+//
+// Detection is done at runtime (using the `cpuid` instruction on x86), so that a single build
+// can select the fastest supported kernels on every machine it runs on.
+//
+// On non-x86 platforms, all features are reported as unsupported.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace CpuFeatures {
+
+struct FeatureSet {
+	bool sse42 = false;
+	bool popcnt = false;
+	bool avx2 = false;
+	bool avx512f = false;
+	bool avx512bw = false;
+	bool avx512vl = false;
+	bool bmi1 = false;
+	bool bmi2 = false;
+	bool lzcnt = false;
+};
+
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || \
+	((defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)))
+
+// Executes `cpuid` for the given leaf and subleaf. Writes eax, ebx, ecx and edx to `registers`.
+inline void ExecuteCpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+#if defined(_MSC_VER)
+	int values[4];
+
+	__cpuidex(values, int(leaf), int(subleaf));
+
+	for (int i = 0; i < 4; i++) {
+		registers[i] = uint32_t(values[i]);
+	}
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Reads the XCR0 register, which tells which register states the operating system
+// saves on context switches. AVX and AVX-512 instructions can only be used when the
+// operating system supports their registers.
+inline uint64_t ReadXcr0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+
+	return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+// Detects the features of the current CPU
+inline FeatureSet DetectFeatures() {
+	FeatureSet features;
+
+	uint32_t registers[4];
+
+	ExecuteCpuid(0, 0, registers);
+	uint32_t maximumLeaf = registers[0];
+
+	ExecuteCpuid(0x80000000, 0, registers);
+	uint32_t maximumExtendedLeaf = registers[0];
+
+	if (maximumLeaf < 1) {
+		return features;
+	}
+
+	ExecuteCpuid(1, 0, registers);
+
+	features.sse42 = (registers[2] >> 20) & 1;
+	features.popcnt = (registers[2] >> 23) & 1;
+
+	bool osSavesRegisters = (registers[2] >> 27) & 1;
+	bool cpuSupportsAvx = (registers[2] >> 28) & 1;
+
+	uint64_t xcr0 = osSavesRegisters ? ReadXcr0() : 0;
+
+	// XMM and YMM register states
+	bool osSupportsAvx = cpuSupportsAvx && (xcr0 & 0x6) == 0x6;
+
+	// Opmask, upper ZMM and high ZMM register states, in addition to XMM and YMM
+	bool osSupportsAvx512 = osSupportsAvx && (xcr0 & 0xE0) == 0xE0;
+
+	if (maximumLeaf >= 7) {
+		ExecuteCpuid(7, 0, registers);
+
+		features.bmi1 = (registers[1] >> 3) & 1;
+		features.bmi2 = (registers[1] >> 8) & 1;
+
+		features.avx2 = osSupportsAvx && ((registers[1] >> 5) & 1);
+
+		features.avx512f = osSupportsAvx512 && ((registers[1] >> 16) & 1);
+		features.avx512bw = osSupportsAvx512 && ((registers[1] >> 30) & 1);
+		features.avx512vl = osSupportsAvx512 && ((registers[1] >> 31) & 1);
+	}
+
+	if (maximumExtendedLeaf >= 0x80000001) {
+		ExecuteCpuid(0x80000001, 0, registers);
+
+		features.lzcnt = (registers[2] >> 5) & 1;
+	}
+
+	return features;
+}
+
+#else
+
+// Detects the features of the current CPU (not supported on this platform)
+inline FeatureSet DetectFeatures() {
+	return FeatureSet();
+}
+
+#endif
+
+// Gets the features of the current CPU.
+//
+// Detection is only done on the first call. Later calls return the cached result.
+inline const FeatureSet& GetDetectedFeatures() {
+	static const FeatureSet detectedFeatures = DetectFeatures();
+
+	return detectedFeatures;
+}
+
+}  // namespace CpuFeatures
@@ -0,0 +1,243 @@
+#pragma once
+
+#include "FastUint31Division.h"
+#include "FastUint32MultiplicationByFraction.h"
+#include "Uint32DivisionStrategies.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Microbenchmarks for the division and fraction multiplication strategies used by the coders.
+//
+// Each strategy is measured in two modes:
+//
+// * Throughput: operations are independent of each other, so the CPU can overlap them.
+// * Latency: each operation depends on the result of the previous one. This mirrors the encoder
+//   loops, where every state transition depends on the previous state.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace DivisionBenchmark {
+
+// Average time of a single operation, in nanoseconds
+struct OperationTimings {
+	double throughputNanoseconds;
+	double latencyNanoseconds;
+};
+
+struct DivisionStrategyTimings {
+	OperationTimings hardware;
+	OperationTimings magicNumber;
+	OperationTimings lemire;
+	OperationTimings reciprocal;
+};
+
+struct MultiplicationStrategyTimings {
+	OperationTimings fixedPoint;
+	OperationTimings floatingPoint;
+};
+
+// Operation count used when selecting a strategy automatically. Kept small so the selection
+// only takes a few milliseconds.
+inline constexpr int64_t defaultOperationCountPerMeasurement = 1 << 14;
+
+// Number of repetitions of each measurement. The fastest repetition is used.
+inline constexpr int repetitionCount = 3;
+
+// Receives benchmark results, to prevent the compiler from optimizing the measured loops away
+inline volatile uint32_t benchmarkSink = 0;
+
+// Divisors representative of symbol frequencies, for range widths between 2 and 23 bits
+inline constexpr uint32_t representativeDivisors[] = { 3, 255, 4093, 65521, 1234567 };
+
+// Numerator count used for throughput measurements. Must be a power of two.
+inline constexpr int64_t numeratorCount = 1024;
+
+// Generates pseudo-random numerators in the range [0, 2^31), which covers all encoder states
+inline std::vector<uint32_t> GenerateNumerators() {
+	std::vector<uint32_t> numerators;
+	numerators.reserve(numeratorCount);
+
+	// 32-bit xorshift generator
+	uint32_t randomState = 2463534242;
+
+	for (int64_t i = 0; i < numeratorCount; i++) {
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 17;
+		randomState ^= randomState << 5;
+
+		numerators.push_back(randomState & 0x7FFFFFFF);
+	}
+
+	return numerators;
+}
+
+// Measures the time of the given function, and returns the average time per operation
+template <typename MeasuredFunction>
+double MeasureNanosecondsPerOperation(int64_t operationCount, MeasuredFunction&& measuredFunction) {
+	double bestNanoseconds = 0.0;
+
+	for (int repetition = 0; repetition < repetitionCount; repetition++) {
+		auto startTime = std::chrono::steady_clock::now();
+
+		measuredFunction();
+
+		auto endTime = std::chrono::steady_clock::now();
+
+		double nanoseconds = double(std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count());
+
+		if (repetition == 0 || nanoseconds < bestNanoseconds) {
+			bestNanoseconds = nanoseconds;
+		}
+	}
+
+	return bestNanoseconds / double(operationCount);
+}
+
+// Measures a division strategy, given any class providing `DivideAndGetRemainder`
+template <typename Division>
+OperationTimings MeasureDivision(int64_t operationCountPerDivisor = defaultOperationCountPerMeasurement) {
+	auto numerators = GenerateNumerators();
+
+	int64_t divisorCount = sizeof(representativeDivisors) / sizeof(representativeDivisors[0]);
+	int64_t totalOperationCount = operationCountPerDivisor * divisorCount;
+
+	// Throughput: consecutive divisions are independent
+	double throughputNanoseconds = MeasureNanosecondsPerOperation(totalOperationCount, [&]() {
+		uint32_t checksum = 0;
+
+		for (auto divisor : representativeDivisors) {
+			Division division(divisor);
+
+			for (int64_t i = 0; i < operationCountPerDivisor; i++) {
+				auto result = division.DivideAndGetRemainder(numerators[i & (numeratorCount - 1)]);
+
+				checksum += result.quotient ^ result.remainder;
+			}
+		}
+
+		benchmarkSink = checksum;
+	});
+
+	// Latency: each numerator is derived from the previous quotient and remainder
+	double latencyNanoseconds = MeasureNanosecondsPerOperation(totalOperationCount, [&]() {
+		uint32_t numerator = numerators[0];
+
+		for (auto divisor : representativeDivisors) {
+			Division division(divisor);
+
+			for (int64_t i = 0; i < operationCountPerDivisor; i++) {
+				auto result = division.DivideAndGetRemainder(numerator);
+
+				numerator = (result.quotient + result.remainder + numerators[i & (numeratorCount - 1)]) & 0x7FFFFFFF;
+			}
+		}
+
+		benchmarkSink = numerator;
+	});
+
+	return { throughputNanoseconds, latencyNanoseconds };
+}
+
+// Measures all division strategies
+inline DivisionStrategyTimings MeasureDivisionStrategies(int64_t operationCountPerDivisor = defaultOperationCountPerMeasurement) {
+	DivisionStrategyTimings timings;
+
+	timings.hardware = MeasureDivision<HardwareUint32Division>(operationCountPerDivisor);
+	timings.magicNumber = MeasureDivision<FastUint31Division>(operationCountPerDivisor);
+	timings.lemire = MeasureDivision<LemireUint32Division>(operationCountPerDivisor);
+	timings.reciprocal = MeasureDivision<ReciprocalUint32Division>(operationCountPerDivisor);
+
+	return timings;
+}
+
+// Measures fixed-point (`FastUint32MultiplicationByFraction`) and plain floating point
+// multiplication by a fraction.
+//
+// Unlike the division strategies, the two don't always produce the same results,
+// so the arithmetic coder can't switch between them at runtime without breaking
+// compatibility with previously encoded data. The measurement is informational only.
+inline MultiplicationStrategyTimings MeasureMultiplicationStrategies(int64_t operationCount = defaultOperationCountPerMeasurement) {
+	auto multiplicands = GenerateNumerators();
+
+	const double fraction = 0.8125;
+
+	FastUint32MultiplicationByFraction fixedPointMultiplication(fraction);
+
+	MultiplicationStrategyTimings timings;
+
+	timings.fixedPoint.throughputNanoseconds = MeasureNanosecondsPerOperation(operationCount, [&]() {
+		uint32_t checksum = 0;
+
+		for (int64_t i = 0; i < operationCount; i++) {
+			checksum += fixedPointMultiplication.Multiply(multiplicands[i & (numeratorCount - 1)]);
+		}
+
+		benchmarkSink = checksum;
+	});
+
+	timings.fixedPoint.latencyNanoseconds = MeasureNanosecondsPerOperation(operationCount, [&]() {
+		uint32_t multiplicand = multiplicands[0];
+
+		for (int64_t i = 0; i < operationCount; i++) {
+			multiplicand = fixedPointMultiplication.Multiply(multiplicand) + multiplicands[i & (numeratorCount - 1)];
+		}
+
+		benchmarkSink = multiplicand;
+	});
+
+	timings.floatingPoint.throughputNanoseconds = MeasureNanosecondsPerOperation(operationCount, [&]() {
+		uint32_t checksum = 0;
+
+		for (int64_t i = 0; i < operationCount; i++) {
+			checksum += uint32_t(double(multiplicands[i & (numeratorCount - 1)]) * fraction);
+		}
+
+		benchmarkSink = checksum;
+	});
+
+	timings.floatingPoint.latencyNanoseconds = MeasureNanosecondsPerOperation(operationCount, [&]() {
+		uint32_t multiplicand = multiplicands[0];
+
+		for (int64_t i = 0; i < operationCount; i++) {
+			multiplicand = uint32_t(double(multiplicand) * fraction) + multiplicands[i & (numeratorCount - 1)];
+		}
+
+		benchmarkSink = multiplicand;
+	});
+
+	return timings;
+}
+
+// Selects the division strategy with the lowest latency.
+//
+// Latency is used, rather than throughput, since the rANS encoder's state transitions form a
+// dependency chain, where each division depends on the result of the previous one.
+inline Uint32DivisionStrategy SelectFastestDivisionStrategy(const DivisionStrategyTimings& timings) {
+	auto fastestStrategy = Uint32DivisionStrategy::MagicNumber;
+	double fastestLatency = timings.magicNumber.latencyNanoseconds;
+
+	auto consider = [&](Uint32DivisionStrategy strategy, const OperationTimings& strategyTimings) {
+		if (strategyTimings.latencyNanoseconds < fastestLatency) {
+			fastestStrategy = strategy;
+			fastestLatency = strategyTimings.latencyNanoseconds;
+		}
+	};
+
+	consider(Uint32DivisionStrategy::Hardware, timings.hardware);
+	consider(Uint32DivisionStrategy::Lemire, timings.lemire);
+	consider(Uint32DivisionStrategy::Reciprocal, timings.reciprocal);
+
+	return fastestStrategy;
+}
+
+// Gets the fastest division strategy for the current CPU.
+//
+// The benchmark is only run on the first call. Later calls return the cached result.
+inline Uint32DivisionStrategy GetFastestDivisionStrategy() {
+	static const Uint32DivisionStrategy fastestStrategy = SelectFastestDivisionStrategy(MeasureDivisionStrategies());
+
+	return fastestStrategy;
+}
+
+}  // namespace DivisionBenchmark
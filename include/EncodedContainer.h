@@ -0,0 +1,449 @@
+#pragma once
+
+#include "BitArray.h"
+#include "BinaryArithmeticCoder.h"
+#include "BinaryRangeANSCoder.h"
+#include "FastUint32MultiplicationByFraction.h"
+
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Self-describing container format for encoded data.
+//
+// Layout:
+//
+// * Magic bytes: 'E', 'C'
+// * Header, as a sequence of unsigned LEB128 variable-length integers ("varints"):
+//   format version, engine, range bit width, quantized probability, decoded bit length,
+//   final state, encoded bit length and block count
+// * Optional block index: for each block, its decoded bit length, encoded bit length and final state
+// * Payload: the encoded bytes. When there is a block index, each block's encoded data starts
+//   at a byte boundary.
+//
+// The quantized probability is engine specific:
+//
+// * Binary rANS: the quantized frequency of symbol 0 (see `BinaryRangeANSCoder::GetFrequencyOf`)
+// * Binary arithmetic coding: the scaled multiplier for the probability of 0
+//   (see `FastUint32MultiplicationByFraction::ScaledMultiplier`)
+//
+// Both are stored exactly, so the decoder reproduces the encoder's model bit for bit.
+//
+// Parsing is zero-copy: the parsed container refers directly into the given buffer, so decoding
+// can start straight from a memory-mapped file.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace EncodedContainer {
+
+inline constexpr uint8_t magicBytes[2] = { 'E', 'C' };
+
+inline constexpr uint64_t formatVersion = 1;
+
+enum class Engine : uint8_t {
+	BinaryArithmetic = 1,
+	BinaryRangeANS = 2,
+};
+
+struct Header {
+	Engine engine = Engine::BinaryRangeANS;
+
+	// Range bit width (for binary arithmetic coding, always 32)
+	uint8_t rangeBitWidth = 0;
+
+	// Engine specific quantized probability (see above)
+	uint64_t quantizedProbability = 0;
+
+	// Length of the decoded message, in bits
+	int64_t bitLength = 0;
+
+	// Final encoder state (binary rANS only, when there is no block index)
+	uint32_t finalState = 0;
+
+	// Length of the encoded data, in bits (for binary rANS, always a multiple of 8)
+	int64_t encodedBitLength = 0;
+
+	// Number of entries in the block index, or 0 if there is no block index
+	int64_t blockCount = 0;
+};
+
+struct BlockIndexEntry {
+	// Length of the decoded block, in bits
+	int64_t bitLength;
+
+	// Length of the encoded block, in bits
+	int64_t encodedBitLength;
+
+	// Final encoder state (binary rANS only)
+	uint32_t finalState;
+
+	// Offsets of the block's first decoded bit within the message, and of its first encoded byte
+	// within the payload. Not serialized, since they can be derived from the lengths.
+	int64_t bitOffset;
+	int64_t encodedByteOffset;
+};
+
+// A parsed container. Refers directly into the parsed buffer.
+struct ContainerView {
+	Header header;
+
+	// Start of the serialized block index, if there is one
+	const uint8_t* blockIndex;
+
+	// Start and length of the payload
+	const uint8_t* payload;
+	int64_t payloadByteLength;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variable-length integer encoding (unsigned LEB128)
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Appends a varint to the given byte vector
+inline void WriteVarint(uint64_t value, std::vector<uint8_t>& outputBytes) {
+	while (value >= 0x80) {
+		outputBytes.push_back(uint8_t(value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+
+	outputBytes.push_back(uint8_t(value));
+}
+
+// Reads a varint, and advances the read position past it
+inline uint64_t ReadVarint(const uint8_t*& readPosition, const uint8_t* end) {
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (readPosition >= end) {
+			throw std::exception("Unexpected end of data while reading a varint.");
+		}
+
+		uint8_t byte = *readPosition++;
+
+		value |= uint64_t(byte & 0x7F) << shift;
+
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+
+	throw std::exception("Varint is too long.");
+}
+
+// Reads a varint holding a length or a count. Larger values can't be valid, and would overflow
+// when converted to bytes, or summed.
+inline int64_t ReadLengthVarint(const uint8_t*& readPosition, const uint8_t* end) {
+	uint64_t value = ReadVarint(readPosition, end);
+
+	if (value > uint64_t(INT64_MAX / 8)) {
+		throw std::exception("Container length field is out of range.");
+	}
+
+	return int64_t(value);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Header creation
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Creates a header for data encoded with `BinaryRangeANSCoder::Encode` (or `EncodeUsingTable`)
+inline Header CreateBinaryRangeANSHeader(const BinaryRangeANSCoder& coder,
+										 int64_t bitLength,
+										 int64_t encodedByteLength,
+										 uint32_t finalState) {
+	Header header;
+
+	header.engine = Engine::BinaryRangeANS;
+	header.rangeBitWidth = coder.GetTotalRangeBitWidth();
+	header.quantizedProbability = coder.GetFrequencyOf(0);
+	header.bitLength = bitLength;
+	header.finalState = finalState;
+	header.encodedBitLength = encodedByteLength * 8;
+
+	return header;
+}
+
+// Creates a header for data encoded with `BinaryArithmeticCoder::Encode`
+inline Header CreateBinaryArithmeticHeader(double probabilityOf1, int64_t bitLength, int64_t encodedBitLength) {
+	Header header;
+
+	header.engine = Engine::BinaryArithmetic;
+	header.rangeBitWidth = uint8_t(BinaryArithmeticCoder::totalRangeBitWidth);
+	header.quantizedProbability = BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(probabilityOf1).ScaledMultiplier();
+	header.bitLength = bitLength;
+	header.encodedBitLength = encodedBitLength;
+
+	return header;
+}
+
+// Creates the rANS coder described by a header
+inline BinaryRangeANSCoder CreateBinaryRangeANSCoder(const Header& header) {
+	if (header.engine != Engine::BinaryRangeANS) {
+		throw std::exception("Container wasn't encoded with binary rANS.");
+	}
+
+	return BinaryRangeANSCoder::FromFrequencyOf0(uint32_t(header.quantizedProbability), header.rangeBitWidth);
+}
+
+// Creates the arithmetic coder's multiplication object described by a header
+inline FastUint32MultiplicationByFraction CreateBinaryArithmeticMultiplication(const Header& header) {
+	if (header.engine != Engine::BinaryArithmetic) {
+		throw std::exception("Container wasn't encoded with binary arithmetic coding.");
+	}
+
+	return FastUint32MultiplicationByFraction::FromScaledMultiplier(header.quantizedProbability);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writing
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Appends the magic bytes, header and block index (if given) to the output vector.
+//
+// The payload isn't included, so it can be written separately (for example, with a gathering
+// write), without copying it.
+inline void WriteHeader(Header header,
+						const std::vector<BlockIndexEntry>* blockIndex,
+						std::vector<uint8_t>& outputBytes) {
+
+	header.blockCount = blockIndex != nullptr ? int64_t(blockIndex->size()) : 0;
+
+	outputBytes.push_back(magicBytes[0]);
+	outputBytes.push_back(magicBytes[1]);
+
+	WriteVarint(formatVersion, outputBytes);
+	WriteVarint(uint64_t(header.engine), outputBytes);
+	WriteVarint(header.rangeBitWidth, outputBytes);
+	WriteVarint(header.quantizedProbability, outputBytes);
+	WriteVarint(uint64_t(header.bitLength), outputBytes);
+	WriteVarint(header.finalState, outputBytes);
+	WriteVarint(uint64_t(header.encodedBitLength), outputBytes);
+	WriteVarint(uint64_t(header.blockCount), outputBytes);
+
+	if (blockIndex != nullptr) {
+		for (auto& entry : *blockIndex) {
+			WriteVarint(uint64_t(entry.bitLength), outputBytes);
+			WriteVarint(uint64_t(entry.encodedBitLength), outputBytes);
+			WriteVarint(entry.finalState, outputBytes);
+		}
+	}
+}
+
+// Appends a complete container (header, block index and payload) to the output vector
+inline void WriteContainer(const Header& header,
+						   const std::vector<BlockIndexEntry>* blockIndex,
+						   const uint8_t* payload,
+						   int64_t payloadByteLength,
+						   std::vector<uint8_t>& outputBytes) {
+
+	WriteHeader(header, blockIndex, outputBytes);
+
+	outputBytes.insert(outputBytes.end(), payload, payload + payloadByteLength);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Parsing
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Checks that the range bit width and quantized probability of a header describe a model the
+// encoder could have produced, so no coder is built from an invalid one
+inline void ValidateModel(uint64_t rangeBitWidth, const Header& header) {
+	if (header.engine == Engine::BinaryRangeANS) {
+		if (rangeBitWidth < 2 || rangeBitWidth > 23) {
+			throw std::exception("Container range bit width must be between 2 and 23 (inclusive) for binary rANS.");
+		}
+
+		if (header.quantizedProbability < 1 || header.quantizedProbability >= (1ULL << rangeBitWidth)) {
+			throw std::exception("Container frequency of 0 must be between 1 and 2^rangeBitWidth - 1 (inclusive).");
+		}
+	} else {
+		if (rangeBitWidth != uint64_t(BinaryArithmeticCoder::totalRangeBitWidth)) {
+			throw std::exception("Container range bit width must be 32 for binary arithmetic coding.");
+		}
+
+		// The encoder clips probabilities away from 0 and 1, so both subintervals are never empty
+		uint64_t minScaledMultiplier = BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(1.0).ScaledMultiplier();
+		uint64_t maxScaledMultiplier = BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(0.0).ScaledMultiplier();
+
+		if (header.quantizedProbability < minScaledMultiplier || header.quantizedProbability > maxScaledMultiplier) {
+			throw std::exception("Container scaled multiplier is out of range.");
+		}
+	}
+}
+
+// Parses a container, without copying its payload
+inline ContainerView ParseContainer(const uint8_t* data, int64_t byteLength) {
+	const uint8_t* readPosition = data;
+	const uint8_t* end = data + byteLength;
+
+	if (byteLength < 2 || data[0] != magicBytes[0] || data[1] != magicBytes[1]) {
+		throw std::exception("Data doesn't start with the container magic bytes.");
+	}
+
+	readPosition += 2;
+
+	if (ReadVarint(readPosition, end) != formatVersion) {
+		throw std::exception("Unsupported container format version.");
+	}
+
+	ContainerView view;
+
+	auto engine = ReadVarint(readPosition, end);
+
+	if (engine != uint64_t(Engine::BinaryArithmetic) && engine != uint64_t(Engine::BinaryRangeANS)) {
+		throw std::exception("Unsupported container engine.");
+	}
+
+	view.header.engine = Engine(engine);
+
+	auto rangeBitWidth = ReadVarint(readPosition, end);
+	view.header.quantizedProbability = ReadVarint(readPosition, end);
+
+	ValidateModel(rangeBitWidth, view.header);
+	view.header.rangeBitWidth = uint8_t(rangeBitWidth);
+
+	view.header.bitLength = ReadLengthVarint(readPosition, end);
+	view.header.finalState = uint32_t(ReadVarint(readPosition, end));
+	view.header.encodedBitLength = ReadLengthVarint(readPosition, end);
+	view.header.blockCount = ReadLengthVarint(readPosition, end);
+
+	// Skip over the block index (it is only decoded on demand, by `ReadBlockIndex`), checking that
+	// the block lengths are consistent with the header and the data
+	view.blockIndex = readPosition;
+
+	int64_t payloadByteLength = 0;
+
+	if (view.header.blockCount > 0) {
+		int64_t totalBitLength = 0;
+
+		for (int64_t i = 0; i < view.header.blockCount; i++) {
+			totalBitLength += ReadLengthVarint(readPosition, end);
+			payloadByteLength += (ReadLengthVarint(readPosition, end) + 7) / 8;
+			ReadVarint(readPosition, end);
+
+			// Checked on every entry, so the sums can't overflow
+			if (totalBitLength > view.header.bitLength) {
+				throw std::exception("Container block bit lengths exceed the decoded bit length.");
+			}
+
+			if (payloadByteLength > byteLength) {
+				throw std::exception("Container payload is truncated.");
+			}
+		}
+
+		if (totalBitLength != view.header.bitLength) {
+			throw std::exception("Container block bit lengths don't add up to the decoded bit length.");
+		}
+	} else {
+		payloadByteLength = (view.header.encodedBitLength + 7) / 8;
+	}
+
+	if (end - readPosition < payloadByteLength) {
+		throw std::exception("Container payload is truncated.");
+	}
+
+	view.payload = readPosition;
+	view.payloadByteLength = payloadByteLength;
+
+	return view;
+}
+
+// Reads the block index of a parsed container, and computes the offsets of the blocks.
+// Every block is checked to be within the decoded message and the payload.
+inline std::vector<BlockIndexEntry> ReadBlockIndex(const ContainerView& view) {
+	std::vector<BlockIndexEntry> blockIndex;
+	blockIndex.reserve(view.header.blockCount);
+
+	const uint8_t* readPosition = view.blockIndex;
+
+	int64_t bitOffset = 0;
+	int64_t encodedByteOffset = 0;
+
+	for (int64_t i = 0; i < view.header.blockCount; i++) {
+		BlockIndexEntry entry;
+
+		entry.bitLength = ReadLengthVarint(readPosition, view.payload);
+		entry.encodedBitLength = ReadLengthVarint(readPosition, view.payload);
+		entry.finalState = uint32_t(ReadVarint(readPosition, view.payload));
+		entry.bitOffset = bitOffset;
+		entry.encodedByteOffset = encodedByteOffset;
+
+		if (entry.bitLength > view.header.bitLength - bitOffset) {
+			throw std::exception("Container block extends past the end of the decoded message.");
+		}
+
+		if ((entry.encodedBitLength + 7) / 8 > view.payloadByteLength - encodedByteOffset) {
+			throw std::exception("Container block extends past the end of the payload.");
+		}
+
+		bitOffset += entry.bitLength;
+		encodedByteOffset += (entry.encodedBitLength + 7) / 8;
+
+		blockIndex.push_back(entry);
+	}
+
+	if (bitOffset != view.header.bitLength) {
+		throw std::exception("Container block bit lengths don't add up to the decoded bit length.");
+	}
+
+	return blockIndex;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Decoding
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Decodes a single encoded stream, with the engine and model described by the header
+inline void DecodeStream(const Header& header,
+						 const uint8_t* encodedBytes,
+						 int64_t encodedBitLength,
+						 uint32_t finalState,
+						 BitArray& outputBitArray) {
+
+	// The decoders only read from the encoded bytes
+	auto bytes = const_cast<uint8_t*>(encodedBytes);
+
+	if (header.engine == Engine::BinaryRangeANS) {
+		auto coder = CreateBinaryRangeANSCoder(header);
+
+		coder.Decode(bytes, encodedBitLength / 8, finalState, outputBitArray);
+	} else {
+		auto fastMultiplicationByProbabilityOf0 = CreateBinaryArithmeticMultiplication(header);
+
+		BitArray inputBitArray(bytes, encodedBitLength);
+
+		BinaryArithmeticCoder::Decode(inputBitArray, outputBitArray, fastMultiplicationByProbabilityOf0);
+	}
+}
+
+// Decodes the entire message held by a parsed container.
+// outputBitArray should be pre-sized to `header.bitLength`, and zero-filled.
+//
+// When there is a block index, all blocks except the last must have bit lengths
+// that are a multiple of 8, so they can be decoded in place.
+inline void DecodeContainer(const ContainerView& view, BitArray& outputBitArray) {
+	if (outputBitArray.BitLength() != view.header.bitLength) {
+		throw std::exception("Output bit array length doesn't match the container's bit length.");
+	}
+
+	if (view.header.blockCount == 0) {
+		DecodeStream(view.header, view.payload, view.header.encodedBitLength, view.header.finalState, outputBitArray);
+
+		return;
+	}
+
+	auto blockIndex = ReadBlockIndex(view);
+
+	for (int64_t i = 0; i < int64_t(blockIndex.size()); i++) {
+		auto& entry = blockIndex[i];
+
+		if (entry.bitOffset % 8 != 0) {
+			throw std::exception("Block bit offsets must be a multiple of 8.");
+		}
+
+		BitArray blockOutputBitArray(outputBitArray.Data() + (entry.bitOffset / 8), entry.bitLength);
+
+		DecodeStream(view.header, view.payload + entry.encodedByteOffset, entry.encodedBitLength, entry.finalState, blockOutputBitArray);
+	}
+}
+
+}  // namespace EncodedContainer
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "BitArray.h"
+#include "BinaryArithmeticCoder.h"
+#include "BinaryRangeANSCoder.h"
+#include "FastUint32MultiplicationByFraction.h"
+#include "FixedPointLog2.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Encoded size estimation, without encoding.
+//
+// For both coders, the encoded length of a message depends almost entirely on its symbol counts:
+// each symbol costs close to `-log2(probability)` bits, as quantized by the coder. So the size is
+// estimated by counting the 1 bits of the message (using popcounts), and multiplying the counts by
+// code lengths computed once per model (in fixed point, see `FixedPointLog2`). The products are
+// taken in double precision, so counts of any size are supported.
+//
+// The remaining difference comes from the coders' rounding and termination:
+//
+// * Arithmetic coder: each step rounds the subinterval of 0 down, by at most 1 in an interval
+//   length of at least 2^30, and termination adds between 1 and 2 bits. The returned bounds are
+//   guaranteed.
+//
+// * rANS: the cost of each step depends on the state, and integer division makes it slightly
+//   higher than `-log2(probability)`, on average. The model measures the average deviation of each
+//   symbol once, by running the coder's state machine over a fixed number of pseudorandom steps. The returned
+//   bounds are a statistical band (4 standard deviations wide, on each side), not a guarantee.
+//   The estimate covers the flushed bytes only. The final state, returned separately by the
+//   encoder, takes `totalRangeBitWidth + 8` more bits.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace EncodedSizeEstimation {
+
+struct EncodedSizeEstimate {
+	double estimatedBitLength = 0.0;
+
+	// Bounds for the actual bit length
+	double minimumBitLength = 0.0;
+	double maximumBitLength = 0.0;
+
+	// Estimated length in bytes, rounded up
+	int64_t EstimatedByteLength() const { return int64_t(std::ceil(estimatedBitLength / 8)); }
+};
+
+struct SymbolCounts {
+	uint64_t countOf0 = 0;
+	uint64_t countOf1 = 0;
+};
+
+// Counts the 0 and 1 bits of the given message
+inline SymbolCounts CountSymbols(BitArray& message) {
+	SymbolCounts counts;
+
+	counts.countOf1 = message.CountOnesInRange(0, message.BitLength());
+	counts.countOf0 = message.BitLength() - counts.countOf1;
+
+	return counts;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Arithmetic coder
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+class ArithmeticCoderSizeModel {
+   private:
+	// Code lengths of the symbols, in fixed point (see `FixedPointLog2`)
+	int64_t codeLengthOf[2];
+
+	// Maximum per-symbol deviation from the code lengths, due to rounding of the interval boundary.
+	// Rounding shrinks the subinterval of 0 (costing more) and grows the subinterval of 1 (costing less).
+	double maximumRoundingCostOf0;
+	double maximumRoundingSavingOf1;
+
+	// Termination outputs 1 bit, plus the pending bits (at most 1 more bit than the remaining information).
+	static constexpr double minimumTerminationBitLength = 0.0;
+	static constexpr double maximumTerminationBitLength = 2.0;
+
+   public:
+	// Models the coder using the same multiplier the encoder would use for the given probability of 1
+	ArithmeticCoderSizeModel(double probabilityOf1)
+		: ArithmeticCoderSizeModel(BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(probabilityOf1)) {
+	}
+
+	ArithmeticCoderSizeModel(FastUint32MultiplicationByFraction fastMultiplicationByProbabilityOf0) {
+		uint64_t scaledMultiplier = fastMultiplicationByProbabilityOf0.ScaledMultiplier();
+
+		if (scaledMultiplier == 0 || scaledMultiplier >= (1ULL << 32)) {
+			throw std::exception("Probability of 0 must be strictly between 0.0 and 1.0.");
+		}
+
+		int64_t totalRangeBits = int64_t(BinaryArithmeticCoder::totalRangeBitWidth) << FixedPointLog2::fractionBitWidth;
+
+		codeLengthOf[0] = totalRangeBits - FixedPointLog2::Log2(scaledMultiplier);
+		codeLengthOf[1] = totalRangeBits - FixedPointLog2::Log2((1ULL << 32) - scaledMultiplier);
+
+		// After normalization, the interval length is more than a quarter of the range, so rounding the
+		// boundary down by less than 1 changes a subinterval by a relative amount of at most
+		// `4 / scaledMultiplier` (for 0) or `4 / (2^32 - scaledMultiplier)` (for 1)
+		double relativeRoundingOf0 = 4.0 / double(scaledMultiplier);
+		double relativeRoundingOf1 = 4.0 / double((1ULL << 32) - scaledMultiplier);
+
+		maximumRoundingCostOf0 = relativeRoundingOf0 < 1.0 ? -std::log2(1.0 - relativeRoundingOf0) : INFINITY;
+		maximumRoundingSavingOf1 = std::log2(1.0 + relativeRoundingOf1);
+	}
+
+	// Gets the code length of the given symbol, in bits
+	double CodeLengthOf(uint8_t symbol) const { return FixedPointLog2::ToDouble(codeLengthOf[symbol]); }
+
+	// Estimates the encoded bit length of a message with the given symbol counts
+	EncodedSizeEstimate Estimate(uint64_t countOf0, uint64_t countOf1) const {
+		double codeLength = (double(countOf0) * CodeLengthOf(0)) + (double(countOf1) * CodeLengthOf(1));
+
+		EncodedSizeEstimate result;
+
+		result.minimumBitLength = std::max(codeLength - (double(countOf1) * maximumRoundingSavingOf1) + minimumTerminationBitLength, 0.0);
+		result.maximumBitLength = codeLength + (double(countOf0) * maximumRoundingCostOf0) + maximumTerminationBitLength;
+		result.estimatedBitLength = codeLength + (minimumTerminationBitLength + maximumTerminationBitLength) / 2;
+
+		return result;
+	}
+
+	EncodedSizeEstimate Estimate(const SymbolCounts& counts) const {
+		return Estimate(counts.countOf0, counts.countOf1);
+	}
+
+	// Estimates the encoded bit length of the given message
+	EncodedSizeEstimate Estimate(BitArray& message) const {
+		return Estimate(CountSymbols(message));
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// rANS coder
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+class RangeANSSizeModel {
+   private:
+	uint8_t totalRangeBitWidth;
+
+	// Code lengths of the symbols, in fixed point (see `FixedPointLog2`)
+	int64_t codeLengthOf[2];
+
+	// Mean deviation of the cost of each symbol from its code length, in bits, and the variance of the
+	// accumulated deviation, per encoded symbol
+	double meanDeviationOf[2];
+	double deviationVariancePerSymbol;
+
+	// Number of steps simulated when computing the deviation statistics, and the length of the
+	// blocks used for estimating the variance (the deviations of successive steps are correlated)
+	static constexpr int simulatedStepCount = 1 << 18;
+	static constexpr int simulatedBlockLength = 1 << 10;
+
+	// Width of the statistical band around the estimate, in standard deviations
+	static constexpr double bandWidthInStandardDeviations = 4.0;
+
+	// Cost of encoding the given symbol at the given state, in excess of its code length (in fixed
+	// point), and the resulting state. The cost of a step is the number of flushed bits, plus the
+	// change of the state's logarithm. Summed over a message, it telescopes to the encoded bit length
+	// (plus the logarithm of the final state, minus the logarithm of the initial one).
+	int64_t StepDeviation(const BinaryRangeANSCoder& coder, uint8_t symbol, uint32_t state, uint32_t& newState) const {
+		uint32_t frequency = coder.GetFrequencyOf(symbol);
+		uint32_t cumulativeFrequency = symbol == 0 ? 0 : coder.GetFrequencyOf(0);
+
+		uint32_t initialState = state;
+		int64_t flushedBitCount = 0;
+
+		while (state >= frequency * 256) {
+			state >>= 8;
+			flushedBitCount += 8;
+		}
+
+		newState = ((state / frequency) << totalRangeBitWidth) + cumulativeFrequency + (state % frequency);
+
+		return (flushedBitCount << FixedPointLog2::fractionBitWidth) +
+			   FixedPointLog2::Log2(newState) - FixedPointLog2::Log2(initialState) - codeLengthOf[symbol];
+	}
+
+	// Computes the deviation statistics by running the coder's state machine over a pseudorandom
+	// message, where each bit is 1 with the given probability.
+	//
+	// At every step, the cost of both symbols is evaluated at the current state, so the mean of a
+	// rare symbol is accurate even if it is seldom (or never) sampled. The result is deterministic.
+	void ComputeDeviationStatistics(const BinaryRangeANSCoder& coder, double sourceProbabilityOf1) {
+		auto thresholdFor1 = uint64_t(clip(sourceProbabilityOf1, 0.0, 1.0) * double(1ULL << 32));
+
+		int64_t deviationSumOf[2] = { 0, 0 };
+
+		std::vector<int64_t> stepDeviations(simulatedStepCount);
+		std::vector<uint8_t> stepSymbols(simulatedStepCount);
+
+		uint32_t state = coder.GetTotalFrequency();
+		uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+		for (int step = 0; step < simulatedStepCount; step++) {
+			// xorshift64
+			randomState ^= randomState << 13;
+			randomState ^= randomState >> 7;
+			randomState ^= randomState << 17;
+
+			uint8_t symbol = (randomState >> 32) < thresholdFor1 ? 1 : 0;
+
+			uint32_t newStateOf[2];
+			int64_t deviationOf[2];
+
+			for (uint8_t s = 0; s <= 1; s++) {
+				deviationOf[s] = StepDeviation(coder, s, state, newStateOf[s]);
+				deviationSumOf[s] += deviationOf[s];
+			}
+
+			stepDeviations[step] = deviationOf[symbol];
+			stepSymbols[step] = symbol;
+
+			state = newStateOf[symbol];
+		}
+
+		for (uint8_t s = 0; s <= 1; s++) {
+			meanDeviationOf[s] = FixedPointLog2::ToDouble(deviationSumOf[s]) / simulatedStepCount;
+		}
+
+		// Variance of the sums of the deviations (from their means) over blocks of steps
+		int blockCount = simulatedStepCount / simulatedBlockLength;
+		double sumOfSquares = 0.0;
+
+		for (int block = 0; block < blockCount; block++) {
+			double blockSum = 0.0;
+
+			for (int step = block * simulatedBlockLength; step < (block + 1) * simulatedBlockLength; step++) {
+				blockSum += FixedPointLog2::ToDouble(stepDeviations[step]) - meanDeviationOf[stepSymbols[step]];
+			}
+
+			sumOfSquares += blockSum * blockSum;
+		}
+
+		deviationVariancePerSymbol = sumOfSquares / blockCount / simulatedBlockLength;
+	}
+
+   public:
+	// Models the given coder, for messages where each bit is 1 with the given probability.
+	//
+	// Construction simulates a quarter million coder steps (a few milliseconds), so a model should be
+	// created once per coder configuration and reused.
+	//
+	// The probability only affects the distribution of the coder's states, so a rough value is
+	// sufficient. When the coder's quantized frequencies are far from the source probabilities
+	// (for example, with a very small total range), passing the source probability makes the
+	// estimates considerably more accurate.
+	RangeANSSizeModel(const BinaryRangeANSCoder& coder, double sourceProbabilityOf1) {
+		totalRangeBitWidth = coder.GetTotalRangeBitWidth();
+
+		int64_t totalRangeBits = int64_t(totalRangeBitWidth) << FixedPointLog2::fractionBitWidth;
+
+		for (uint8_t symbol = 0; symbol <= 1; symbol++) {
+			codeLengthOf[symbol] = totalRangeBits - FixedPointLog2::Log2(coder.GetFrequencyOf(symbol));
+		}
+
+		ComputeDeviationStatistics(coder, sourceProbabilityOf1);
+	}
+
+	// Models the given coder, for messages distributed according to its own frequencies
+	RangeANSSizeModel(const BinaryRangeANSCoder& coder)
+		: RangeANSSizeModel(coder, double(coder.GetFrequencyOf(1)) / double(coder.GetTotalFrequency())) {
+	}
+
+	// Gets the code length of the given symbol, in bits
+	double CodeLengthOf(uint8_t symbol) const { return FixedPointLog2::ToDouble(codeLengthOf[symbol]); }
+
+	// Gets the bit width needed to store the final state (in the range [totalFrequency, totalFrequency * 256))
+	int FinalStateBitWidth() const { return totalRangeBitWidth + 8; }
+
+	// Estimates the bit length of the encoded bytes (excluding the final state) of a message with the
+	// given symbol counts
+	EncodedSizeEstimate Estimate(uint64_t countOf0, uint64_t countOf1) const {
+		double codeLength = (double(countOf0) * CodeLengthOf(0)) + (double(countOf1) * CodeLengthOf(1));
+
+		double meanDeviation = (double(countOf0) * meanDeviationOf[0]) + (double(countOf1) * meanDeviationOf[1]);
+		// Variance of the message's own deviations, plus the uncertainty of the simulated means
+		double symbolCount = double(countOf0 + countOf1);
+		double deviationVariance = (symbolCount + (symbolCount * symbolCount / simulatedStepCount)) * deviationVariancePerSymbol;
+
+		double band = bandWidthInStandardDeviations * std::sqrt(deviationVariance);
+
+		// The encoded bits and the final state's logarithm add up to the total cost, plus the
+		// initial state's logarithm (`totalRangeBitWidth`). The final state's logarithm is in
+		// [totalRangeBitWidth, totalRangeBitWidth + 8), so the encoded bits are up to 8 bits less
+		// than the total cost.
+		double totalCost = codeLength + meanDeviation;
+
+		EncodedSizeEstimate result;
+
+		result.estimatedBitLength = std::max(totalCost - 4.0, 0.0);
+		result.minimumBitLength = std::max(totalCost - 8.0 - band, 0.0);
+		result.maximumBitLength = totalCost + band;
+
+		return result;
+	}
+
+	EncodedSizeEstimate Estimate(const SymbolCounts& counts) const {
+		return Estimate(counts.countOf0, counts.countOf1);
+	}
+
+	// Estimates the bit length of the encoded bytes (excluding the final state) of the given message
+	EncodedSizeEstimate Estimate(BitArray& message) const {
+		return Estimate(CountSymbols(message));
+	}
+};
+
+}  // namespace EncodedSizeEstimation
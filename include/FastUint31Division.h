@@ -60,11 +60,11 @@ class FastUint31Division {
 		multiplier =  ((1ULL << shiftAmount) + (divisor - 1)) / divisor;
 	}
 
-	inline uint32_t Divide(uint32_t numerator) {
+	inline uint32_t Divide(uint32_t numerator) const {
 		return (numerator * multiplier) >> shiftAmount;
 	}
 
-	inline QuotientAndRemainderUint32 DivideAndGetRemainder(uint32_t numerator) {
+	inline QuotientAndRemainderUint32 DivideAndGetRemainder(uint32_t numerator) const {
 		uint32_t quotient = (numerator * multiplier) >> shiftAmount;
 		uint32_t remainder = numerator - (quotient * divisor);
 
@@ -11,6 +11,10 @@ class FastUint32MultiplicationByFraction {
    private:
 	uint64_t scaledMultiplier;
 
+	FastUint32MultiplicationByFraction() {
+		scaledMultiplier = 0;
+	}
+
    public:
 	const uint64_t scaleFactor = 1ULL << 32;
 
@@ -23,6 +27,23 @@ class FastUint32MultiplicationByFraction {
 		scaledMultiplier = uint64_t(fractionBetween0And1 * scaleFactor);
 	}
 
+	// Creates a multiplication object directly from a scaled multiplier (`fraction * 2^32`),
+	// as returned by `ScaledMultiplier`. Allows reproducing the exact same multiplier from a
+	// serialized value, without a round trip through floating point.
+	static FastUint32MultiplicationByFraction FromScaledMultiplier(uint64_t scaledMultiplier) {
+		if (scaledMultiplier > (1ULL << 32)) {
+			throw std::exception("Scaled multiplier must be between 0 and 2^32 (inclusive)");
+		}
+
+		FastUint32MultiplicationByFraction result;
+		result.scaledMultiplier = scaledMultiplier;
+
+		return result;
+	}
+
+	// Gets the scaled multiplier (`fraction * 2^32`, rounded down)
+	uint64_t ScaledMultiplier() { return scaledMultiplier; }
+
 	uint32_t Multiply(uint32_t multiplicand) {
 		// Efficiently computes:
 		// multiplicand * fractionBetween0And1
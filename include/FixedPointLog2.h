@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Utilities.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// Fixed-point base 2 logarithm of unsigned integers, using a lookup table.
+//
+// Results are in units of 2^-24 bits (24 fractional bits). The integer part is the position
+// of the highest 1 bit. The fractional part is looked up in a table of 4096 entries, indexed by
+// the 12 bits following the highest 1 bit, and linearly interpolated using the next 24 bits.
+// The maximum error is about 2^-24 bits (a couple of units of the last place).
+//
+// Used for evaluating code lengths (sums of `-log2(probability)` terms) with integer arithmetic,
+// so results are deterministic, and comparisons between candidates aren't affected by floating point rounding.
+class FixedPointLog2 {
+   public:
+	static constexpr int fractionBitWidth = 24;
+	static constexpr int64_t one = int64_t(1) << fractionBitWidth;
+
+   private:
+	static constexpr int tableIndexBitWidth = 12;
+	static constexpr int tableSize = 1 << tableIndexBitWidth;
+
+	// log2(1 + i / tableSize), in fixed point, with an extra entry for interpolating the last one
+	static const std::array<uint32_t, tableSize + 1>& Table() {
+		static const std::array<uint32_t, tableSize + 1> table = [] {
+			std::array<uint32_t, tableSize + 1> result {};
+
+			for (int i = 0; i <= tableSize; i++) {
+				result[i] = uint32_t(std::lround(std::log2(1.0 + double(i) / tableSize) * one));
+			}
+
+			return result;
+		}();
+
+		return table;
+	}
+
+   public:
+	// Computes log2(value) in fixed point. `value` must be positive.
+	static int64_t Log2(uint64_t value) {
+		auto& table = Table();
+
+		int highestBitPosition = 63 - EntropyCodingUtilities::countLeadingZeros64(value);
+
+		// Shift the highest 1 bit to bit 63, so the following bits are the fraction
+		uint64_t normalizedValue = value << (63 - highestBitPosition);
+
+		auto tableIndex = uint32_t((normalizedValue >> (63 - tableIndexBitWidth)) & (tableSize - 1));
+		auto interpolationWeight = uint32_t((normalizedValue >> (63 - tableIndexBitWidth - fractionBitWidth)) & (one - 1));
+
+		uint32_t lower = table[tableIndex];
+		uint32_t upper = table[tableIndex + 1];
+
+		uint32_t fraction = lower + uint32_t((uint64_t(upper - lower) * interpolationWeight) >> fractionBitWidth);
+
+		return (int64_t(highestBitPosition) << fractionBitWidth) + fraction;
+	}
+
+	// Converts a fixed-point value to a double
+	static double ToDouble(int64_t fixedPointValue) {
+		return double(fixedPointValue) / double(one);
+	}
+};
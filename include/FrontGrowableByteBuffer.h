@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Byte buffer that grows at its front.
+//
+// Content is stored at the end of the underlying vector, with free space (headroom) before it.
+// Prepending a byte takes constant amortized time: when the headroom is exhausted, the content is
+// moved to a new vector with headroom proportional to the content size.
+//
+// Used for prepending new encoded bytes to an existing rANS stream.
+class FrontGrowableByteBuffer {
+   private:
+	std::vector<uint8_t> storage;
+
+	// Content occupies [contentStart, storage.size())
+	int64_t contentStart;
+
+	static constexpr int64_t minimumHeadroomGrowth = 64;
+
+   public:
+	FrontGrowableByteBuffer(int64_t initialHeadroom = 0)
+		: storage(initialHeadroom), contentStart(initialHeadroom) {
+	}
+
+	// Creates a buffer with a copy of the given content
+	FrontGrowableByteBuffer(const uint8_t* bytes, int64_t byteLength, int64_t initialHeadroom = 0)
+		: storage(initialHeadroom + byteLength), contentStart(initialHeadroom) {
+		if (byteLength > 0) {
+			std::memcpy(storage.data() + contentStart, bytes, byteLength);
+		}
+	}
+
+	inline void PushFront(uint8_t byte) {
+		if (contentStart == 0) {
+			ReserveHeadroom(1);
+		}
+
+		storage[--contentStart] = byte;
+	}
+
+	// Prepends a block of bytes, keeping their order
+	void PushFront(const uint8_t* bytes, int64_t byteLength) {
+		ReserveHeadroom(byteLength);
+
+		contentStart -= byteLength;
+
+		if (byteLength > 0) {
+			std::memcpy(storage.data() + contentStart, bytes, byteLength);
+		}
+	}
+
+	// Ensures the given number of bytes can be prepended without moving the content
+	void ReserveHeadroom(int64_t headroom) {
+		if (contentStart >= headroom) {
+			return;
+		}
+
+		// Grow geometrically, to keep the amortized cost of prepending constant
+		int64_t newHeadroom = std::max({ headroom, Size(), minimumHeadroomGrowth });
+
+		std::vector<uint8_t> newStorage(newHeadroom + Size());
+
+		if (Size() > 0) {
+			std::memcpy(newStorage.data() + newHeadroom, Data(), Size());
+		}
+
+		storage.swap(newStorage);
+		contentStart = newHeadroom;
+	}
+
+	// Clears the content, turning all allocated memory into headroom
+	void Clear() { contentStart = storage.size(); }
+
+	int64_t Size() { return int64_t(storage.size()) - contentStart; }
+
+	int64_t Headroom() { return contentStart; }
+
+	uint8_t* Data() { return storage.data() + contentStart; }
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+#if defined(__linux__)
+#define ENTROPY_CODING_HAS_HUGE_PAGES 1
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#else
+#define ENTROPY_CODING_HAS_HUGE_PAGES 0
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Memory resource backed by huge pages, intended for large lookup tables, like the rANS
+// state transition tables.
+//
+// Table lookups are effectively random accesses. With 4 KiB pages, a table of 8 - 64 MiB spans
+// thousands of pages, far more than the TLB can hold, so most lookups incur a TLB miss (and a page
+// walk). With 2 MiB pages, the same table spans only a few pages.
+//
+// Each large allocation is mapped separately:
+//
+// 1. First, using explicit huge pages (`MAP_HUGETLB`), of the configured size. These need to be
+//    reserved by the system administrator (`/proc/sys/vm/nr_hugepages`), so they're often unavailable.
+// 2. Otherwise, using regular pages, aligned to 2 MiB, and marked with `MADV_HUGEPAGE`, so that
+//    transparent huge pages (THP) are used, if enabled.
+//
+// Small allocations (less than 1 MiB) are forwarded to the upstream resource.
+// All allocations are aligned to at least a cache line.
+//
+// With prefaulting enabled, pages are faulted in during allocation, on the allocating thread,
+// rather than on first access. Since Linux places pages on the NUMA node of the thread that first
+// touches them, memory allocated (or first written) by the thread that builds a table is local
+// to that thread's node.
+//
+// Only available on Linux. Elsewhere, all allocations are forwarded to the upstream resource.
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class HugePageSize : uint8_t {
+	Size2MiB = 21,
+	Size1GiB = 30,
+};
+
+class HugePageMemoryResource : public std::pmr::memory_resource {
+   private:
+	static constexpr size_t cacheLineSize = 64;
+	static constexpr size_t transparentHugePageSize = size_t(1) << 21;
+
+	HugePageSize hugePageSize;
+	bool prefault;
+	std::pmr::memory_resource* upstreamResource;
+
+	std::atomic<int64_t> explicitHugePageAllocationCount { 0 };
+	std::atomic<int64_t> transparentHugePageAllocationCount { 0 };
+	std::atomic<int64_t> upstreamAllocationCount { 0 };
+
+	// Mapped length of each current (non-upstream) allocation. It depends on which mapping
+	// succeeded, so it can't be recomputed from the size on deallocation.
+	std::mutex mappedLengthsMutex;
+	std::unordered_map<void*, size_t> mappedLengths;
+
+   public:
+	HugePageMemoryResource(HugePageSize hugePageSize = HugePageSize::Size2MiB,
+						   bool prefault = false,
+						   std::pmr::memory_resource* upstreamResource = std::pmr::get_default_resource())
+		: hugePageSize(hugePageSize), prefault(prefault), upstreamResource(upstreamResource) {
+	}
+
+	HugePageMemoryResource(const HugePageMemoryResource&) = delete;
+	HugePageMemoryResource& operator=(const HugePageMemoryResource&) = delete;
+
+	// Number of allocations currently or previously mapped with explicit huge pages (`MAP_HUGETLB`)
+	int64_t ExplicitHugePageAllocationCount() { return explicitHugePageAllocationCount.load(); }
+
+	// Number of allocations mapped with regular pages, marked for transparent huge pages
+	int64_t TransparentHugePageAllocationCount() { return transparentHugePageAllocationCount.load(); }
+
+	// Number of allocations forwarded to the upstream resource
+	int64_t UpstreamAllocationCount() { return upstreamAllocationCount.load(); }
+
+   private:
+	size_t HugePageByteSize() { return size_t(1) << uint8_t(hugePageSize); }
+
+	// Is an allocation of the given size forwarded to the upstream resource?
+	bool IsUpstreamAllocation(size_t byteCount, size_t alignment) {
+		return !ENTROPY_CODING_HAS_HUGE_PAGES || byteCount < transparentHugePageSize / 2 || alignment > transparentHugePageSize;
+	}
+
+	// Are explicit huge pages attempted for an allocation of the given size?
+	// Not done for allocations smaller than half a huge page, to limit the wasted memory.
+	bool IsExplicitHugePageCandidate(size_t byteCount) {
+		return byteCount >= HugePageByteSize() / 2;
+	}
+
+	// Rounds the given size up to a multiple of the given page size
+	static size_t RoundUpToPageSize(size_t byteCount, size_t pageSize) {
+		return (byteCount + pageSize - 1) / pageSize * pageSize;
+	}
+
+#if ENTROPY_CODING_HAS_HUGE_PAGES
+	// Records the mapped length of a new allocation, for deallocating it. Unmaps it if recording fails.
+	void* RecordMapping(void* mapping, size_t mappedLength) {
+		try {
+			std::lock_guard<std::mutex> lock(mappedLengthsMutex);
+
+			mappedLengths[mapping] = mappedLength;
+		} catch (...) {
+			munmap(mapping, mappedLength);
+
+			throw;
+		}
+
+		return mapping;
+	}
+#endif
+
+	void* do_allocate(size_t byteCount, size_t alignment) override {
+		alignment = std::max(alignment, cacheLineSize);
+
+		if (IsUpstreamAllocation(byteCount, alignment)) {
+			upstreamAllocationCount++;
+
+			return upstreamResource->allocate(byteCount, alignment);
+		}
+
+#if ENTROPY_CODING_HAS_HUGE_PAGES
+		int populateFlag = prefault ? MAP_POPULATE : 0;
+
+		// Try explicit huge pages first. Huge page mappings are always aligned to the huge page size.
+		if (IsExplicitHugePageCandidate(byteCount)) {
+			size_t hugePageMappedLength = RoundUpToPageSize(byteCount, HugePageByteSize());
+
+			void* mapping = mmap(nullptr, hugePageMappedLength, PROT_READ | PROT_WRITE,
+								 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (int(hugePageSize) << MAP_HUGE_SHIFT) | populateFlag,
+								 -1, 0);
+
+			if (mapping != MAP_FAILED) {
+				explicitHugePageAllocationCount++;
+
+				return RecordMapping(mapping, hugePageMappedLength);
+			}
+		}
+
+		// Fall back to regular pages, rounded to transparent huge pages (rather than to the explicit
+		// huge page size, which would waste up to 1 GiB). Map an extra transparent huge page, so the
+		// start can be aligned to it, then unmap the unaligned head and the unused tail.
+		size_t mappedLength = RoundUpToPageSize(byteCount, transparentHugePageSize);
+		size_t paddedLength = mappedLength + transparentHugePageSize;
+
+		void* mapping = mmap(nullptr, paddedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapping == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+
+		auto mappingAddress = uintptr_t(mapping);
+		auto alignedAddress = (mappingAddress + transparentHugePageSize - 1) & ~uintptr_t(transparentHugePageSize - 1);
+
+		size_t headLength = alignedAddress - mappingAddress;
+		size_t tailLength = paddedLength - headLength - mappedLength;
+
+		if (headLength > 0) {
+			munmap(mapping, headLength);
+		}
+
+		if (tailLength > 0) {
+			munmap((void*)(alignedAddress + mappedLength), tailLength);
+		}
+
+		// Advice is only a hint. It fails if THP is disabled, in which case regular pages are used.
+		madvise((void*)alignedAddress, mappedLength, MADV_HUGEPAGE);
+
+		// Touch a byte in each page, from the allocating thread. Done after the advice, since
+		// `MAP_POPULATE` would fault the pages in before it, as regular pages.
+		if (prefault) {
+			auto pageSize = size_t(sysconf(_SC_PAGESIZE));
+
+			for (size_t offset = 0; offset < mappedLength; offset += pageSize) {
+				((volatile uint8_t*)alignedAddress)[offset] = 0;
+			}
+		}
+
+		transparentHugePageAllocationCount++;
+
+		return RecordMapping((void*)alignedAddress, mappedLength);
+#else
+		return nullptr;
+#endif
+	}
+
+	void do_deallocate(void* pointer, size_t byteCount, size_t alignment) override {
+		alignment = std::max(alignment, cacheLineSize);
+
+		if (IsUpstreamAllocation(byteCount, alignment)) {
+			upstreamResource->deallocate(pointer, byteCount, alignment);
+
+			return;
+		}
+
+#if ENTROPY_CODING_HAS_HUGE_PAGES
+		size_t mappedLength;
+
+		{
+			std::lock_guard<std::mutex> lock(mappedLengthsMutex);
+
+			auto entry = mappedLengths.find(pointer);
+
+			if (entry == mappedLengths.end()) {
+				return;
+			}
+
+			mappedLength = entry->second;
+			mappedLengths.erase(entry);
+		}
+
+		munmap(pointer, mappedLength);
+#endif
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+};
+
+// Gets a shared huge page memory resource (2 MiB pages, without prefaulting)
+inline HugePageMemoryResource& GetHugePageMemoryResource() {
+	static HugePageMemoryResource hugePageMemoryResource;
+
+	return hugePageMemoryResource;
+}
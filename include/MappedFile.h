@@ -0,0 +1,378 @@
+#pragma once
+
+#include "BitArray.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ENTROPY_CODING_HAS_MMAP 1
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define ENTROPY_CODING_HAS_MMAP 0
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Memory-mapped files, used as zero-copy coder inputs and outputs.
+//
+// Mapping a file avoids reading it into heap memory first. Pages are loaded by the kernel
+// on demand and can be evicted under memory pressure, so files larger than RAM can be encoded
+// or decoded directly.
+//
+// `MappedInputFile` exposes a read-only file as a `BitArray`. `MappedOutputFile` is a file-backed
+// byte container that grows (by `ftruncate` and remapping) as bytes are appended, and can be passed
+// as the output of the rANS encoder. `MappedOutputBitStream` is the equivalent of `OutputBitStream`,
+// for the arithmetic encoder.
+//
+// Only available on POSIX platforms. Elsewhere, the constructors throw.
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace MappedFileUtilities {
+
+#if ENTROPY_CODING_HAS_MMAP
+inline int64_t GetPageSize() {
+	static int64_t pageSize = int64_t(sysconf(_SC_PAGESIZE));
+
+	return pageSize;
+}
+
+// Applies the given advice to the pages overlapping the byte range [offset, offset + length).
+// Advice is only a hint, so failures are ignored.
+inline void AdviseRange(uint8_t* data, int64_t byteLength, int64_t offset, int64_t length, int advice) {
+	if (data == nullptr || offset >= byteLength || length <= 0) {
+		return;
+	}
+
+	if (offset < 0) {
+		length += offset;
+		offset = 0;
+	}
+
+	if (offset + length > byteLength) {
+		length = byteLength - offset;
+	}
+
+	// The start address must be page aligned
+	int64_t pageSize = GetPageSize();
+	int64_t alignedOffset = offset - (offset % pageSize);
+
+	madvise(data + alignedOffset, size_t(length + (offset - alignedOffset)), advice);
+}
+#endif
+
+}  // namespace MappedFileUtilities
+
+// Read-only memory-mapped file
+class MappedInputFile {
+   private:
+	uint8_t* data = nullptr;
+	int64_t byteLength = 0;
+	int fileDescriptor = -1;
+
+   public:
+	MappedInputFile(const std::string& path) {
+#if ENTROPY_CODING_HAS_MMAP
+		fileDescriptor = open(path.c_str(), O_RDONLY);
+
+		if (fileDescriptor < 0) {
+			throw std::exception("Couldn't open input file.");
+		}
+
+		struct stat fileStatus;
+
+		if (fstat(fileDescriptor, &fileStatus) != 0) {
+			close(fileDescriptor);
+			throw std::exception("Couldn't get input file size.");
+		}
+
+		byteLength = int64_t(fileStatus.st_size);
+
+		// Empty files can't be mapped
+		if (byteLength > 0) {
+			void* mapping = mmap(nullptr, size_t(byteLength), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+
+			if (mapping == MAP_FAILED) {
+				close(fileDescriptor);
+				throw std::exception("Couldn't map input file.");
+			}
+
+			data = (uint8_t*)mapping;
+		}
+#else
+		throw std::exception("Memory-mapped files are not supported on this platform.");
+#endif
+	}
+
+	~MappedInputFile() {
+#if ENTROPY_CODING_HAS_MMAP
+		if (data != nullptr) {
+			munmap(data, size_t(byteLength));
+		}
+
+		if (fileDescriptor >= 0) {
+			close(fileDescriptor);
+		}
+#endif
+	}
+
+	MappedInputFile(const MappedInputFile&) = delete;
+	MappedInputFile& operator=(const MappedInputFile&) = delete;
+
+	// The mapping is read-only. Writing through the returned pointer is not allowed.
+	uint8_t* Data() { return data; }
+
+	int64_t ByteLength() { return byteLength; }
+
+	// Views the file content as a bit array, of the given bit length (or the full file by default)
+	BitArray AsBitArray(int64_t bitLength = -1) {
+		if (bitLength < 0) {
+			bitLength = byteLength * 8;
+		}
+
+		if (bitLength > byteLength * 8) {
+			throw std::exception("Bit length exceeds the file size.");
+		}
+
+		return BitArray(data, bitLength);
+	}
+
+	// Hints that the file will be read in forward order (like by the arithmetic coder, or the
+	// rANS decoder). The kernel reads ahead more aggressively, and drops pages after they're read.
+	void AdviseSequential() {
+#if ENTROPY_CODING_HAS_MMAP
+		MappedFileUtilities::AdviseRange(data, byteLength, 0, byteLength, MADV_SEQUENTIAL);
+#endif
+	}
+
+	// Hints that the file will be read in reverse order (like by the rANS encoder).
+	//
+	// Restores the default advice, whose readahead also loads some pages around each faulting one
+	// (disabling readahead entirely would make a backward walk fault on every page), and prefetches
+	// the given window at the end of the file, where reading starts.
+	void AdviseReverse(int64_t prefetchWindowByteLength = 64 << 20) {
+#if ENTROPY_CODING_HAS_MMAP
+		MappedFileUtilities::AdviseRange(data, byteLength, 0, byteLength, MADV_NORMAL);
+
+		PrefetchRange(byteLength - prefetchWindowByteLength, prefetchWindowByteLength);
+#endif
+	}
+
+	// Asynchronously loads the pages in the given byte range
+	void PrefetchRange(int64_t offset, int64_t length) {
+#if ENTROPY_CODING_HAS_MMAP
+		MappedFileUtilities::AdviseRange(data, byteLength, offset, length, MADV_WILLNEED);
+#endif
+	}
+
+	// Hints that the pages in the given byte range are no longer needed, and can be evicted
+	void ReleaseRange(int64_t offset, int64_t length) {
+#if ENTROPY_CODING_HAS_MMAP
+		MappedFileUtilities::AdviseRange(data, byteLength, offset, length, MADV_DONTNEED);
+#endif
+	}
+};
+
+// Writable memory-mapped file, used as a growable byte container.
+//
+// Supports the subset of the `std::vector<uint8_t>` interface used by the rANS encoder
+// (`size`, `push_back`, `begin` and `end`), so it can be passed directly as its output.
+//
+// The file is created (or truncated) on construction. Its capacity grows geometrically, and
+// on `Finish` (or destruction), it's truncated to the actual content length.
+class MappedOutputFile {
+   private:
+	uint8_t* data = nullptr;
+	int64_t byteLength = 0;
+	int64_t byteCapacity = 0;
+	int fileDescriptor = -1;
+
+   public:
+	MappedOutputFile(const std::string& path, int64_t initialByteCapacity = 1 << 20) {
+#if ENTROPY_CODING_HAS_MMAP
+		fileDescriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+		if (fileDescriptor < 0) {
+			throw std::exception("Couldn't create output file.");
+		}
+
+		Reserve(initialByteCapacity > 0 ? initialByteCapacity : 1);
+#else
+		throw std::exception("Memory-mapped files are not supported on this platform.");
+#endif
+	}
+
+	~MappedOutputFile() {
+		// Errors can't be reported from the destructor. Call `Finish` first to detect them.
+		try {
+			Finish();
+		} catch (...) {
+		}
+	}
+
+	MappedOutputFile(const MappedOutputFile&) = delete;
+	MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+	inline void push_back(uint8_t value) {
+		if (byteLength == byteCapacity) {
+			Reserve(byteCapacity * 2);
+		}
+
+		data[byteLength++] = value;
+	}
+
+	int64_t size() { return byteLength; }
+
+	uint8_t* begin() { return data; }
+	uint8_t* end() { return data + byteLength; }
+
+	uint8_t* Data() { return data; }
+
+	int64_t ByteLength() { return byteLength; }
+
+	// Sets the content length. New bytes are zeroed.
+	//
+	// Used to pre-size a file that's decoded into (using `AsBitArray`), since the decoders only
+	// set 1 bits, and expect the output to be zeroed.
+	void Resize(int64_t newByteLength) {
+		if (newByteLength > byteCapacity) {
+			Reserve(newByteLength);
+		}
+
+		if (newByteLength < byteLength) {
+			// Zero the truncated bytes, so they're zero if the file grows again
+			std::fill(data + newByteLength, data + byteLength, uint8_t(0));
+		}
+
+		byteLength = newByteLength;
+	}
+
+	// Views the file content as a bit array, of the given bit length (or the full content by default).
+	// The view is invalidated when the file grows.
+	BitArray AsBitArray(int64_t bitLength = -1) {
+		if (bitLength < 0) {
+			bitLength = byteLength * 8;
+		}
+
+		if (bitLength > byteLength * 8) {
+			throw std::exception("Bit length exceeds the file size.");
+		}
+
+		return BitArray(data, bitLength);
+	}
+
+	// Grows the file and its mapping to at least the given capacity.
+	// Pointers to the mapped content are invalidated.
+	void Reserve(int64_t newByteCapacity) {
+#if ENTROPY_CODING_HAS_MMAP
+		if (newByteCapacity <= byteCapacity) {
+			return;
+		}
+
+		if (fileDescriptor < 0) {
+			throw std::exception("Output file has already been finished.");
+		}
+
+		// Extending the file fills it with zeros (usually without allocating disk blocks)
+		if (ftruncate(fileDescriptor, off_t(newByteCapacity)) != 0) {
+			throw std::exception("Couldn't extend output file.");
+		}
+
+		void* mapping;
+
+		if (data == nullptr) {
+			mapping = mmap(nullptr, size_t(newByteCapacity), PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+		} else {
+#if defined(__linux__)
+			mapping = mremap(data, size_t(byteCapacity), size_t(newByteCapacity), MREMAP_MAYMOVE);
+#else
+			// Content is kept in the file (and page cache), so a new mapping sees it. The old mapping
+			// is only unmapped once the new one succeeds.
+			mapping = mmap(nullptr, size_t(newByteCapacity), PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+
+			if (mapping != MAP_FAILED) {
+				munmap(data, size_t(byteCapacity));
+			}
+#endif
+		}
+
+		// On failure, the existing mapping (if any) is still valid, and is kept
+		if (mapping == MAP_FAILED) {
+			throw std::exception("Couldn't map output file.");
+		}
+
+		data = (uint8_t*)mapping;
+		byteCapacity = newByteCapacity;
+
+		// The default advice is kept: the rANS encoder reverses its output in place, so the content is
+		// read back, and not only written sequentially.
+#endif
+	}
+
+	// Unmaps the file, truncates it to the content length, and closes it.
+	// No more bytes can be written afterwards.
+	void Finish() {
+#if ENTROPY_CODING_HAS_MMAP
+		if (fileDescriptor < 0) {
+			return;
+		}
+
+		if (data != nullptr) {
+			munmap(data, size_t(byteCapacity));
+			data = nullptr;
+		}
+
+		int truncateResult = ftruncate(fileDescriptor, off_t(byteLength));
+
+		close(fileDescriptor);
+		fileDescriptor = -1;
+
+		if (truncateResult != 0) {
+			throw std::exception("Couldn't truncate output file.");
+		}
+#endif
+	}
+};
+
+// Bit stream writing to a memory-mapped file.
+//
+// Has the same interface as `OutputBitStream`, so it can be passed as the output of the
+// arithmetic encoder.
+class MappedOutputBitStream {
+   private:
+	MappedOutputFile file;
+	int64_t bitLength = 0;
+
+   public:
+	MappedOutputBitStream(const std::string& path, int64_t initialBitCapacity = 1 << 23)
+		: file(path, (initialBitCapacity + 7) / 8) {
+	}
+
+	inline void WriteBit(uint8_t bit) {
+		auto byteIndex = bitLength / 8;
+		auto bitIndexInByte = bitLength % 8;
+
+		// New bytes are zeroed when the file is extended
+		if (byteIndex == file.size()) {
+			file.push_back(0);
+		}
+
+		file.Data()[byteIndex] |= bit << bitIndexInByte;
+
+		bitLength += 1;
+	}
+
+	int64_t BitLength() { return bitLength; }
+
+	int64_t ByteLength() { return file.ByteLength(); }
+
+	uint8_t* Data() { return file.Data(); }
+
+	// Truncates the file to the written length, and closes it
+	void Finish() { file.Finish(); }
+};
@@ -1,14 +1,23 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <vector>
 
-class OutputBitStream {
+// Growable bit stream, used as the output of the arithmetic encoder.
+//
+// The allocator of the underlying byte vector can be customized. Use `Reset` to reuse
+// the stream (and its already allocated memory) for a new message.
+template <typename Allocator = std::allocator<uint8_t>>
+class BasicOutputBitStream {
    private:
-	std::vector<uint8_t> bytes;
+	std::vector<uint8_t, Allocator> bytes;
 	int64_t bitLength = 0;
 
    public:
-	OutputBitStream(int64_t initialBitCapacity) {
+	BasicOutputBitStream(int64_t initialBitCapacity, const Allocator& allocator = Allocator())
+		: bytes(allocator) {
 		bytes.reserve((initialBitCapacity + 7) / 8);
 	}
 
@@ -25,9 +34,58 @@ class OutputBitStream {
 		bitLength += 1;
 	}
 
+	// Writes the lowest `bitCount` bits (at most 32) of `bits`, the least significant bit first
+	inline void WriteBits(uint32_t bits, int bitCount) {
+		auto byteIndex = bitLength / 8;
+		auto bitIndexInByte = bitLength % 8;
+
+		auto endByteIndex = (bitLength + bitCount + 7) / 8;
+
+		if (int64_t(bytes.size()) < endByteIndex) {
+			bytes.resize(endByteIndex, 0);
+		}
+
+		uint64_t value = uint64_t(bits & ((1ULL << bitCount) - 1)) << bitIndexInByte;
+
+		for (; byteIndex < endByteIndex; byteIndex++) {
+			bytes[byteIndex] |= uint8_t(value);
+			value >>= 8;
+		}
+
+		bitLength += bitCount;
+	}
+
+	// Clears the stream, keeping its allocated capacity
+	void Reset() {
+		bytes.clear();
+		bitLength = 0;
+	}
+
+	// Sets the bit length of the stream. Bits past the current length are zeroed.
+	void Resize(int64_t newBitLength) {
+		bytes.resize((newBitLength + 7) / 8, 0);
+
+		// Clear any truncated bits in the last byte, so future writes can set them
+		if (newBitLength < bitLength && newBitLength % 8 != 0) {
+			bytes.back() &= uint8_t((1u << (newBitLength % 8)) - 1);
+		}
+
+		bitLength = newBitLength;
+	}
+
+	// Ensures the stream can hold the given number of bits without reallocating
+	void Reserve(int64_t bitCapacity) {
+		bytes.reserve((bitCapacity + 7) / 8);
+	}
+
 	int64_t BitLength() { return bitLength; }
 
 	int64_t ByteLength() { return bytes.size(); }
 
 	uint8_t* Data() { return bytes.data(); }
 };
+
+using OutputBitStream = BasicOutputBitStream<>;
+
+// Output bit stream allocating from a `std::pmr::memory_resource`
+using PmrOutputBitStream = BasicOutputBitStream<std::pmr::polymorphic_allocator<uint8_t>>;
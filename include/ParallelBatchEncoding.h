@@ -0,0 +1,341 @@
+#pragma once
+
+#include "BitArray.h"
+#include "BinaryArithmeticCoder.h"
+#include "BinaryRangeANSCoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Parallel encoding and decoding of large batches of independent messages.
+//
+// Messages are grouped into tasks of consecutive messages, each with roughly the same total bit
+// length (rather than the same message count), so tasks take roughly the same time. The tasks are
+// distributed between the workers' queues upfront. Each worker takes tasks from the back of its own
+// queue, and once it's empty, steals tasks from the front of other workers' queues. Each queue has
+// its own lock, so workers only contend when stealing.
+//
+// Each task is encoded to its own batch, using the batch methods of the coder. Once all tasks are
+// done, the task batches are copied (in parallel) into the output batch, in input order.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace ParallelBatchEncoding {
+
+// A range of consecutive messages, [startMessageIndex, endMessageIndex)
+struct Task {
+	int64_t startMessageIndex;
+	int64_t endMessageIndex;
+};
+
+// Groups consecutive messages into tasks, each with a total bit length of about the given target
+inline std::vector<Task> PartitionByBitLength(BitArray* messages, int64_t messageCount, int64_t targetTaskBitLength) {
+	std::vector<Task> tasks;
+
+	int64_t taskStartMessageIndex = 0;
+	int64_t taskBitLength = 0;
+
+	for (int64_t messageIndex = 0; messageIndex < messageCount; messageIndex++) {
+		// Count a small fixed cost for each message, so that empty messages are still accounted for
+		taskBitLength += messages[messageIndex].BitLength() + 64;
+
+		if (taskBitLength >= targetTaskBitLength) {
+			tasks.push_back({ taskStartMessageIndex, messageIndex + 1 });
+
+			taskStartMessageIndex = messageIndex + 1;
+			taskBitLength = 0;
+		}
+	}
+
+	if (taskStartMessageIndex < messageCount) {
+		tasks.push_back({ taskStartMessageIndex, messageCount });
+	}
+
+	return tasks;
+}
+
+// Gets the number of workers to use, given a requested thread count (0 means all hardware threads)
+inline int64_t ResolveWorkerCount(int64_t threadCount, int64_t taskCount) {
+	if (threadCount <= 0) {
+		threadCount = std::max(int64_t(std::thread::hardware_concurrency()), int64_t(1));
+	}
+
+	return std::max(std::min(threadCount, taskCount), int64_t(1));
+}
+
+// Runs the given tasks on the given number of workers, using work stealing.
+// Calls `handleTask(workerIndex, taskIndex)` for each task.
+//
+// The calling thread acts as worker 0. If any task throws, the first exception is rethrown once
+// all workers have stopped.
+template <typename TaskHandler>
+void RunTasks(int64_t taskCount, int64_t workerCount, TaskHandler&& handleTask) {
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<int64_t> taskIndexes;
+	};
+
+	std::vector<WorkerQueue> queues(workerCount);
+
+	// Give each worker a contiguous range of tasks
+	for (int64_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+		queues[taskIndex * workerCount / taskCount].taskIndexes.push_back(taskIndex);
+	}
+
+	std::exception_ptr firstException;
+	std::mutex exceptionMutex;
+	std::atomic<bool> failed { false };
+
+	auto runWorker = [&](int64_t workerIndex) {
+		while (!failed.load(std::memory_order_relaxed)) {
+			int64_t taskIndex = -1;
+
+			// Take a task from the back of the worker's own queue
+			{
+				auto& ownQueue = queues[workerIndex];
+				std::lock_guard<std::mutex> lock(ownQueue.mutex);
+
+				if (!ownQueue.taskIndexes.empty()) {
+					taskIndex = ownQueue.taskIndexes.back();
+					ownQueue.taskIndexes.pop_back();
+				}
+			}
+
+			// Otherwise, steal a task from the front of another worker's queue
+			for (int64_t offset = 1; taskIndex < 0 && offset < workerCount; offset++) {
+				auto& victimQueue = queues[(workerIndex + offset) % workerCount];
+				std::lock_guard<std::mutex> lock(victimQueue.mutex);
+
+				if (!victimQueue.taskIndexes.empty()) {
+					taskIndex = victimQueue.taskIndexes.front();
+					victimQueue.taskIndexes.pop_front();
+				}
+			}
+
+			// Tasks are never added, so if all queues are empty, the worker is done
+			if (taskIndex < 0) {
+				return;
+			}
+
+			try {
+				handleTask(workerIndex, taskIndex);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(exceptionMutex);
+
+				if (!firstException) {
+					firstException = std::current_exception();
+				}
+
+				failed.store(true, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(workerCount - 1);
+
+	for (int64_t workerIndex = 1; workerIndex < workerCount; workerIndex++) {
+		threads.emplace_back(runWorker, workerIndex);
+	}
+
+	runWorker(0);
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	if (firstException) {
+		std::rethrow_exception(firstException);
+	}
+}
+
+// Default total bit length of the messages in a single task
+inline constexpr int64_t defaultTargetTaskBitLength = 1 << 20;
+
+// Encode a batch of messages in parallel, using the given thread count (0 means all hardware threads).
+// The result is identical to `coder.EncodeBatch`.
+inline void EncodeBatch(const BinaryRangeANSCoder& coder,
+						std::vector<BitArray>& messages,
+						BinaryRangeANSEncodedBatch& batch,
+						int64_t threadCount = 0,
+						int64_t targetTaskBitLength = defaultTargetTaskBitLength) {
+
+	int64_t messageCount = int64_t(messages.size());
+
+	auto tasks = PartitionByBitLength(messages.data(), messageCount, targetTaskBitLength);
+	auto taskCount = int64_t(tasks.size());
+	auto workerCount = ResolveWorkerCount(threadCount, taskCount);
+
+	// Encode each task to its own batch
+	std::vector<BinaryRangeANSEncodedBatch> taskBatches(taskCount);
+
+	RunTasks(taskCount, workerCount, [&](int64_t, int64_t taskIndex) {
+		auto& task = tasks[taskIndex];
+
+		coder.EncodeBatch(messages.data() + task.startMessageIndex, task.endMessageIndex - task.startMessageIndex, taskBatches[taskIndex]);
+	});
+
+	// Compute the offset of each task's encoded bytes in the output arena
+	std::vector<uint64_t> taskByteOffsets(taskCount + 1, 0);
+
+	for (int64_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+		taskByteOffsets[taskIndex + 1] = taskByteOffsets[taskIndex] + taskBatches[taskIndex].encodedBytes.size();
+	}
+
+	batch.Clear();
+
+	batch.encodedBytes.resize(taskByteOffsets[taskCount]);
+	batch.byteOffsets.resize(messageCount + 1);
+	batch.finalStates.resize(messageCount);
+
+	batch.byteOffsets[messageCount] = taskByteOffsets[taskCount];
+
+	// Copy the task batches into place
+	RunTasks(taskCount, workerCount, [&](int64_t, int64_t taskIndex) {
+		auto& task = tasks[taskIndex];
+		auto& taskBatch = taskBatches[taskIndex];
+
+		// The data pointers can be null when a task has no encoded bytes
+		if (!taskBatch.encodedBytes.empty()) {
+			std::memcpy(batch.encodedBytes.data() + taskByteOffsets[taskIndex], taskBatch.encodedBytes.data(), taskBatch.encodedBytes.size());
+		}
+
+		for (int64_t messageIndex = task.startMessageIndex; messageIndex < task.endMessageIndex; messageIndex++) {
+			int64_t indexInTask = messageIndex - task.startMessageIndex;
+
+			batch.byteOffsets[messageIndex] = taskByteOffsets[taskIndex] + taskBatch.byteOffsets[indexInTask];
+			batch.finalStates[messageIndex] = taskBatch.finalStates[indexInTask];
+		}
+
+		// Release the task's memory early
+		taskBatch = BinaryRangeANSEncodedBatch();
+	});
+}
+
+// Decode a batch of messages in parallel. Each output bit array should be pre-sized (and zeroed)
+// to the length of the corresponding message.
+inline void DecodeBatch(const BinaryRangeANSCoder& coder,
+						BinaryRangeANSEncodedBatch& batch,
+						std::vector<BitArray>& outputBitArrays,
+						int64_t threadCount = 0,
+						int64_t targetTaskBitLength = defaultTargetTaskBitLength) {
+
+	if (int64_t(outputBitArrays.size()) != batch.MessageCount()) {
+		throw std::exception("Output bit array count doesn't match the batch message count.");
+	}
+
+	auto tasks = PartitionByBitLength(outputBitArrays.data(), int64_t(outputBitArrays.size()), targetTaskBitLength);
+	auto taskCount = int64_t(tasks.size());
+
+	RunTasks(taskCount, ResolveWorkerCount(threadCount, taskCount), [&](int64_t, int64_t taskIndex) {
+		auto& task = tasks[taskIndex];
+
+		for (int64_t messageIndex = task.startMessageIndex; messageIndex < task.endMessageIndex; messageIndex++) {
+			uint64_t byteOffset = batch.byteOffsets[messageIndex];
+			uint64_t byteLength = batch.byteOffsets[messageIndex + 1] - byteOffset;
+
+			coder.Decode(batch.encodedBytes.data() + byteOffset, int64_t(byteLength), batch.finalStates[messageIndex], outputBitArrays[messageIndex]);
+		}
+	});
+}
+
+// Encode a batch of messages in parallel, using the arithmetic coder.
+// The result is identical to `BinaryArithmeticCoder::EncodeBatch`.
+inline void EncodeBatch(std::vector<BitArray>& messages,
+						BinaryArithmeticCoder::EncodedBatch& batch,
+						double probabilityOf1,
+						int64_t threadCount = 0,
+						int64_t targetTaskBitLength = defaultTargetTaskBitLength) {
+
+	int64_t messageCount = int64_t(messages.size());
+
+	auto tasks = PartitionByBitLength(messages.data(), messageCount, targetTaskBitLength);
+	auto taskCount = int64_t(tasks.size());
+	auto workerCount = ResolveWorkerCount(threadCount, taskCount);
+
+	// Prepared once, and copied by each task
+	auto fastMultiplicationByProbabilityOf0 = BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	std::vector<BinaryArithmeticCoder::EncodedBatch> taskBatches(taskCount);
+
+	RunTasks(taskCount, workerCount, [&](int64_t, int64_t taskIndex) {
+		auto& task = tasks[taskIndex];
+
+		auto taskFastMultiplication = fastMultiplicationByProbabilityOf0;
+
+		BinaryArithmeticCoder::EncodeBatch(messages.data() + task.startMessageIndex,
+										   task.endMessageIndex - task.startMessageIndex,
+										   taskBatches[taskIndex],
+										   taskFastMultiplication);
+	});
+
+	// Each task's encoded bits end at a byte boundary, so they can be concatenated byte-wise
+	std::vector<int64_t> taskByteOffsets(taskCount + 1, 0);
+
+	for (int64_t taskIndex = 0; taskIndex < taskCount; taskIndex++) {
+		taskByteOffsets[taskIndex + 1] = taskByteOffsets[taskIndex] + taskBatches[taskIndex].encodedBits.ByteLength();
+	}
+
+	batch.Clear();
+
+	batch.encodedBits.Resize(taskByteOffsets[taskCount] * 8);
+	batch.bitOffsets.resize(messageCount);
+	batch.encodedBitLengths.resize(messageCount);
+
+	RunTasks(taskCount, workerCount, [&](int64_t, int64_t taskIndex) {
+		auto& task = tasks[taskIndex];
+		auto& taskBatch = taskBatches[taskIndex];
+
+		// The data pointers can be null when a task has no encoded bits
+		if (taskBatch.encodedBits.ByteLength() > 0) {
+			std::memcpy(batch.encodedBits.Data() + taskByteOffsets[taskIndex], taskBatch.encodedBits.Data(), taskBatch.encodedBits.ByteLength());
+		}
+
+		for (int64_t messageIndex = task.startMessageIndex; messageIndex < task.endMessageIndex; messageIndex++) {
+			int64_t indexInTask = messageIndex - task.startMessageIndex;
+
+			batch.bitOffsets[messageIndex] = (taskByteOffsets[taskIndex] * 8) + taskBatch.bitOffsets[indexInTask];
+			batch.encodedBitLengths[messageIndex] = taskBatch.encodedBitLengths[indexInTask];
+		}
+
+		taskBatch = BinaryArithmeticCoder::EncodedBatch();
+	});
+}
+
+// Decode a batch of messages in parallel, using the arithmetic coder. Each output bit array should
+// be pre-sized (and zeroed) to the length of the corresponding message.
+inline void DecodeBatch(BinaryArithmeticCoder::EncodedBatch& batch,
+						std::vector<BitArray>& outputBitArrays,
+						double probabilityOf1,
+						int64_t threadCount = 0,
+						int64_t targetTaskBitLength = defaultTargetTaskBitLength) {
+
+	if (int64_t(outputBitArrays.size()) != batch.MessageCount()) {
+		throw std::exception("Output bit array count doesn't match the batch message count.");
+	}
+
+	auto fastMultiplicationByProbabilityOf0 = BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(probabilityOf1);
+
+	auto tasks = PartitionByBitLength(outputBitArrays.data(), int64_t(outputBitArrays.size()), targetTaskBitLength);
+	auto taskCount = int64_t(tasks.size());
+
+	RunTasks(taskCount, ResolveWorkerCount(threadCount, taskCount), [&](int64_t, int64_t taskIndex) {
+		auto& task = tasks[taskIndex];
+
+		auto taskFastMultiplication = fastMultiplicationByProbabilityOf0;
+
+		for (int64_t messageIndex = task.startMessageIndex; messageIndex < task.endMessageIndex; messageIndex++) {
+			auto inputBitArray = batch.EncodedBitsOf(messageIndex);
+
+			BinaryArithmeticCoder::Decode(inputBitArray, outputBitArrays[messageIndex], taskFastMultiplication);
+		}
+	});
+}
+
+}  // namespace ParallelBatchEncoding
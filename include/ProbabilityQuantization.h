@@ -0,0 +1,233 @@
+#pragma once
+
+#include "BitArray.h"
+#include "FixedPointLog2.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Quantization of symbol probabilities to integer frequencies, for the rANS coder.
+//
+// The coder constructor rounds `probabilityOf0 * totalFrequency`. For skewed probabilities,
+// where the frequency of the rare symbol is small, the relative rounding error is large, and the
+// rounded frequency isn't necessarily the one giving the shortest encoding.
+//
+// Given the symbol counts of a message (or a representative sample), the functions here evaluate
+// the expected code length for each candidate frequency (using fixed-point logarithms):
+//
+//     count0 * (totalRangeBitWidth - log2(frequencyOf0)) + count1 * (totalRangeBitWidth - log2(frequencyOf1))
+//
+// and pick the one minimizing it. The cost is convex in the frequency, so only the frequencies
+// nearest to the ideal one need to be evaluated.
+//
+// The logarithms have a small error (see `FixedPointLog2`), which, multiplied by large counts, can
+// misorder candidates whose code lengths are nearly tied. Candidates within that error of the best
+// one are compared again in double precision.
+//
+// The code length excludes the coder's constant overhead (the final state), which doesn't depend
+// on the frequency.
+//
+// The result can be used to construct a coder with `BinaryRangeANSCoder::FromFrequencyOf0`.
+//////////////////////////////////////////////////////////////////////////////////////////////
+namespace ProbabilityQuantization {
+
+inline constexpr uint8_t minRangeBitWidth = 2;
+inline constexpr uint8_t maxRangeBitWidth = 23;
+
+struct QuantizedFrequency {
+	uint8_t totalRangeBitWidth;
+	uint32_t frequencyOf0;
+
+	// Expected code length of the counted symbols, in bits, using this frequency
+	double expectedCodeLength;
+
+	// Ideal code length of the counted symbols (their empirical entropy, times their count), in bits
+	double idealCodeLength;
+
+	// Expected code length in excess of the ideal, in bits
+	double OverheadBits() const { return expectedCodeLength - idealCodeLength; }
+
+	// Overhead relative to the ideal code length (0.01 means 1% larger). Infinite if the ideal length
+	// is 0 and there is overhead.
+	double RelativeOverhead() const {
+		if (idealCodeLength == 0.0) {
+			return OverheadBits() == 0.0 ? 0.0 : INFINITY;
+		}
+
+		return OverheadBits() / idealCodeLength;
+	}
+};
+
+// Expected code length (in fixed point, see `FixedPointLog2`) of the given symbol counts,
+// using the given frequency of 0.
+inline int64_t ExpectedCodeLengthFixedPoint(uint64_t countOf0,
+											uint64_t countOf1,
+											uint32_t frequencyOf0,
+											uint8_t totalRangeBitWidth) {
+
+	int64_t totalRangeBits = int64_t(totalRangeBitWidth) << FixedPointLog2::fractionBitWidth;
+	uint32_t frequencyOf1 = (1u << totalRangeBitWidth) - frequencyOf0;
+
+	int64_t codeLengthOf0 = totalRangeBits - FixedPointLog2::Log2(frequencyOf0);
+	int64_t codeLengthOf1 = totalRangeBits - FixedPointLog2::Log2(frequencyOf1);
+
+	return (int64_t(countOf0) * codeLengthOf0) + (int64_t(countOf1) * codeLengthOf1);
+}
+
+// Ideal code length (in fixed point) of the given symbol counts: the empirical entropy,
+// times the total count
+inline int64_t IdealCodeLengthFixedPoint(uint64_t countOf0, uint64_t countOf1) {
+	uint64_t totalCount = countOf0 + countOf1;
+
+	if (countOf0 == 0 || countOf1 == 0) {
+		return 0;
+	}
+
+	int64_t log2OfTotalCount = FixedPointLog2::Log2(totalCount);
+
+	int64_t codeLength = (int64_t(countOf0) * (log2OfTotalCount - FixedPointLog2::Log2(countOf0))) +
+						 (int64_t(countOf1) * (log2OfTotalCount - FixedPointLog2::Log2(countOf1)));
+
+	// Rounding errors of the logarithms could otherwise make it slightly negative
+	return std::max(codeLength, int64_t(0));
+}
+
+// Expected code length (in bits, in double precision) of the given symbol counts, using the given
+// frequency of 0. Only used for breaking near-ties of `ExpectedCodeLengthFixedPoint`.
+inline double ExpectedCodeLength(uint64_t countOf0,
+								 uint64_t countOf1,
+								 uint32_t frequencyOf0,
+								 uint8_t totalRangeBitWidth) {
+
+	uint32_t frequencyOf1 = (1u << totalRangeBitWidth) - frequencyOf0;
+
+	return (double(countOf0) * (totalRangeBitWidth - std::log2(double(frequencyOf0)))) +
+		   (double(countOf1) * (totalRangeBitWidth - std::log2(double(frequencyOf1))));
+}
+
+// Finds the frequency of 0 giving the shortest expected code length for the given symbol counts.
+//
+// The fixed-point code lengths need counts less than 2^32. Larger counts are scaled down (by the
+// same power of 2, keeping their ratio) before evaluating them, and the returned code lengths are
+// scaled back up.
+inline QuantizedFrequency QuantizeForCounts(uint64_t countOf0, uint64_t countOf1, uint8_t totalRangeBitWidth) {
+	if (totalRangeBitWidth < minRangeBitWidth || totalRangeBitWidth > maxRangeBitWidth) {
+		throw std::exception("Total range bit width must be between 2 and 23 (inclusive).");
+	}
+
+	int scaleShift = 0;
+
+	while ((std::max(countOf0, countOf1) >> scaleShift) >= (1ULL << 32)) {
+		scaleShift++;
+	}
+
+	if (scaleShift > 0) {
+		// Round to nearest. Both results stay below 2^32.
+		uint64_t half = 1ULL << (scaleShift - 1);
+
+		countOf0 = std::min((countOf0 >> scaleShift) + ((countOf0 & ((half << 1) - 1)) >= half), uint64_t(UINT32_MAX));
+		countOf1 = std::min((countOf1 >> scaleShift) + ((countOf1 & ((half << 1) - 1)) >= half), uint64_t(UINT32_MAX));
+	}
+
+	uint32_t totalFrequency = 1u << totalRangeBitWidth;
+	uint64_t totalCount = countOf0 + countOf1;
+
+	// Ideal (real-valued) frequency, rounded down. With no counts, assume equal probabilities.
+	uint32_t idealFrequencyOf0 = totalFrequency / 2;
+
+	if (totalCount > 0) {
+		idealFrequencyOf0 = uint32_t((double(countOf0) / double(totalCount)) * totalFrequency);
+	}
+
+	// Evaluate the frequencies around the ideal one. Strictly, only the two nearest integers are
+	// needed, but a few more are checked to tolerate rounding of the ideal frequency.
+	uint32_t firstCandidate = uint32_t(std::max(int64_t(idealFrequencyOf0) - 2, int64_t(1)));
+	uint32_t lastCandidate = std::min(idealFrequencyOf0 + 3, totalFrequency - 1);
+
+	uint32_t bestFrequencyOf0 = 0;
+	int64_t bestCodeLength = INT64_MAX;
+
+	int64_t candidateCodeLengths[6];
+
+	for (uint32_t candidate = firstCandidate; candidate <= lastCandidate; candidate++) {
+		int64_t codeLength = ExpectedCodeLengthFixedPoint(countOf0, countOf1, candidate, totalRangeBitWidth);
+
+		candidateCodeLengths[candidate - firstCandidate] = codeLength;
+
+		if (codeLength < bestCodeLength) {
+			bestCodeLength = codeLength;
+			bestFrequencyOf0 = candidate;
+		}
+	}
+
+	// Break near-ties in double precision. Each logarithm is off by at most a few units of the
+	// last place, so the code lengths are off by at most 4 units per counted symbol.
+	int64_t tieTolerance = int64_t(countOf0 + countOf1) * 4;
+	int64_t minimumCodeLength = bestCodeLength;
+	double bestDoubleCodeLength = ExpectedCodeLength(countOf0, countOf1, bestFrequencyOf0, totalRangeBitWidth);
+
+	for (uint32_t candidate = firstCandidate; candidate <= lastCandidate; candidate++) {
+		int64_t codeLength = candidateCodeLengths[candidate - firstCandidate];
+
+		if (candidate == bestFrequencyOf0 || codeLength - minimumCodeLength > tieTolerance) {
+			continue;
+		}
+
+		double doubleCodeLength = ExpectedCodeLength(countOf0, countOf1, candidate, totalRangeBitWidth);
+
+		if (doubleCodeLength < bestDoubleCodeLength) {
+			bestDoubleCodeLength = doubleCodeLength;
+			bestCodeLength = codeLength;
+			bestFrequencyOf0 = candidate;
+		}
+	}
+
+	QuantizedFrequency result;
+
+	result.totalRangeBitWidth = totalRangeBitWidth;
+	result.frequencyOf0 = bestFrequencyOf0;
+	result.expectedCodeLength = std::ldexp(FixedPointLog2::ToDouble(bestCodeLength), scaleShift);
+	result.idealCodeLength = std::ldexp(FixedPointLog2::ToDouble(IdealCodeLengthFixedPoint(countOf0, countOf1)), scaleShift);
+
+	return result;
+}
+
+// Finds the optimal frequency of 0 for the symbols of the given message
+inline QuantizedFrequency QuantizeForMessage(BitArray& message, uint8_t totalRangeBitWidth) {
+	uint64_t countOf1 = message.CountOnesInRange(0, message.BitLength());
+	uint64_t countOf0 = message.BitLength() - countOf1;
+
+	return QuantizeForCounts(countOf0, countOf1, totalRangeBitWidth);
+}
+
+// Finds the smallest range width whose optimal frequency has a relative overhead (see
+// `QuantizedFrequency::RelativeOverhead`) of at most `maxRelativeOverhead`, and returns its
+// quantized frequency. Smaller widths mean smaller (and faster to build) transition tables.
+//
+// If no width in the given range is within the tolerance (for example, if one of the counts is 0,
+// where any quantized frequency has some overhead), returns the result for the largest width.
+inline QuantizedFrequency RecommendRangeBitWidth(uint64_t countOf0,
+												 uint64_t countOf1,
+												 double maxRelativeOverhead,
+												 uint8_t minimumRangeBitWidth = minRangeBitWidth,
+												 uint8_t maximumRangeBitWidth = maxRangeBitWidth) {
+
+	if (minimumRangeBitWidth < minRangeBitWidth || maximumRangeBitWidth > maxRangeBitWidth || minimumRangeBitWidth > maximumRangeBitWidth) {
+		throw std::exception("Range bit widths must be between 2 and 23 (inclusive), with the minimum not larger than the maximum.");
+	}
+
+	for (uint8_t totalRangeBitWidth = minimumRangeBitWidth; totalRangeBitWidth < maximumRangeBitWidth; totalRangeBitWidth++) {
+		auto result = QuantizeForCounts(countOf0, countOf1, totalRangeBitWidth);
+
+		if (result.RelativeOverhead() <= maxRelativeOverhead) {
+			return result;
+		}
+	}
+
+	return QuantizeForCounts(countOf0, countOf1, maximumRangeBitWidth);
+}
+
+}  // namespace ProbabilityQuantization
@@ -0,0 +1,570 @@
+#pragma once
+
+#include "BitArray.h"
+#include "OutputBitStream.h"
+#include "Utilities.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace EntropyCodingUtilities;
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Quasi-arithmetic binary coder (Howard and Vitter).
+//
+// A reduced precision arithmetic coder: the interval is kept at a small integer range
+// [0, 2^rangeBitWidth), so the normalized intervals reachable from the initial one form a small
+// set of states, found with a breadth-first search. Everything the coder does for one bit
+// (the subinterval split, and the normalization, with its output bits and pending bit count)
+// is precomputed into a table indexed by (state, probability class, bit). The inner loops have no
+// multiplications, and no normalization loops.
+//
+// The split of each interval is rounded to the integer range, so compression is slightly worse
+// than the full precision coder. The loss shrinks as the range bit width grows, while the number
+// of states grows roughly with the square of the range.
+//
+// Probability classes are a fixed set of probabilities, chosen when the coder is constructed.
+// Each bit can be coded with any one of them (for example, selected by a context model).
+//
+// For a single probability class, the decoder can use a multi-symbol table (optional, built with
+// `BuildMultiSymbolDecoderTable`), indexed by the state and a window of upcoming encoded bits.
+// Each lookup decodes all the bits that the window determines (up to 16), which makes decoding
+// of skewed sources, where each bit uses a fraction of an encoded bit, much faster.
+//
+// Once constructed, a coder is immutable, and can be used by multiple threads concurrently.
+//////////////////////////////////////////////////////////////////////////////////////////////
+class QuasiArithmeticCoder {
+   public:
+	static constexpr uint8_t minRangeBitWidth = 4;
+	static constexpr uint8_t maxRangeBitWidth = 10;
+
+	static constexpr uint8_t maxLookaheadBitWidth = 8;
+
+	// Maximum number of bits decoded by a single multi-symbol table lookup
+	static constexpr int maxSymbolsPerLookup = 16;
+
+   private:
+	// Everything the coder does for a single bit, in a given state
+	struct Transition {
+		uint32_t nextState;
+
+		// Number of leading bits shared by the normalized interval's bounds (each output as a
+		// bit, with any pending bits following the first one), and the bits themselves
+		uint8_t sharedBitCount;
+		uint16_t sharedBits;
+
+		// Number of middle half normalizations (each adding a pending bit)
+		uint8_t middleShiftCount;
+	};
+
+	// Result of a multi-symbol decoder table lookup
+	struct MultiSymbolDecoderEntry {
+		uint32_t nextState;
+
+		// Decoded bits, the first one in the least significant bit
+		uint16_t symbols;
+		uint8_t symbolCount;
+
+		// Number of encoded bits consumed (lower 7 bits), and whether the top bit of the value is
+		// flipped after the lookup (highest bit). See `DecodeSingleClass`.
+		uint8_t consumedBitCountAndFlip;
+	};
+
+	struct MultiSymbolDecoderTable {
+		std::vector<MultiSymbolDecoderEntry> entries;
+
+		std::once_flag onceFlag;
+		std::atomic<bool> isReady { false };
+	};
+
+	uint8_t rangeBitWidth;
+	uint32_t range;
+
+	uint32_t halfRange;
+	uint32_t quarterRange;
+
+	uint8_t lookaheadBitWidth;
+
+	// Probability of 0 of each class
+	std::vector<double> probabilityOf0OfClass;
+
+	// Interval bounds of each state ([low, high), in the range [0, 2^rangeBitWidth])
+	std::vector<uint16_t> stateLow;
+	std::vector<uint16_t> stateHigh;
+
+	// Boundary between the subintervals of 0 and 1, indexed by (state, class)
+	std::vector<uint16_t> boundaries;
+
+	// Transitions, indexed by (state, class, bit)
+	std::vector<Transition> transitions;
+
+	// Multi-symbol decoder tables, one for each class. Built on request, and shared by all copies
+	// of the coder.
+	std::shared_ptr<std::vector<std::unique_ptr<MultiSymbolDecoderTable>>> multiSymbolDecoderTables;
+
+   public:
+	// Creates a coder with the given probability classes (the probability of 1 for each class).
+	//
+	// The range bit width should be between 4 and 10 (inclusive), and the multi-symbol decoder's
+	// lookahead bit width between 0 and 8 (inclusive). A multi-symbol decoder table has
+	// `StateCount() * 2^(rangeBitWidth + lookaheadBitWidth)` entries, which grows quickly: for a
+	// probability of 0.1, it's about 0.4 MB with the defaults, but over 1 GB with a range bit width
+	// of 10 (see `GetMultiSymbolDecoderTableMemorySize`).
+	QuasiArithmeticCoder(const std::vector<double>& probabilityOf1OfClass, uint8_t rangeBitWidth = 6, uint8_t lookaheadBitWidth = 4) {
+		if (probabilityOf1OfClass.empty() || probabilityOf1OfClass.size() > 256) {
+			throw std::exception("Class count must be between 1 and 256 (inclusive).");
+		}
+
+		if (rangeBitWidth < minRangeBitWidth || rangeBitWidth > maxRangeBitWidth) {
+			throw std::exception("Range bit width must be between 4 and 10 (inclusive).");
+		}
+
+		if (lookaheadBitWidth > maxLookaheadBitWidth) {
+			throw std::exception("Lookahead bit width must be between 0 and 8 (inclusive).");
+		}
+
+		for (double probabilityOf1 : probabilityOf1OfClass) {
+			if (probabilityOf1 < 0.0 || probabilityOf1 > 1.0) {
+				throw std::exception("Probability must be between 0.0 and 1.0 (inclusive).");
+			}
+
+			probabilityOf0OfClass.push_back(1.0 - probabilityOf1);
+		}
+
+		this->rangeBitWidth = rangeBitWidth;
+		this->lookaheadBitWidth = lookaheadBitWidth;
+
+		range = 1u << rangeBitWidth;
+		halfRange = range / 2;
+		quarterRange = range / 4;
+
+		BuildStatesAndTransitions();
+
+		multiSymbolDecoderTables = std::make_shared<std::vector<std::unique_ptr<MultiSymbolDecoderTable>>>();
+
+		for (size_t i = 0; i < probabilityOf0OfClass.size(); i++) {
+			multiSymbolDecoderTables->push_back(std::make_unique<MultiSymbolDecoderTable>());
+		}
+	}
+
+	// Creates a coder with a single probability class
+	QuasiArithmeticCoder(double probabilityOf1, uint8_t rangeBitWidth = 6, uint8_t lookaheadBitWidth = 4)
+		: QuasiArithmeticCoder(std::vector<double> { probabilityOf1 }, rangeBitWidth, lookaheadBitWidth) {
+	}
+
+	uint8_t GetRangeBitWidth() const { return rangeBitWidth; }
+
+	int64_t ClassCount() const { return int64_t(probabilityOf0OfClass.size()); }
+
+	int64_t StateCount() const { return int64_t(stateLow.size()); }
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Encoding
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Encode message bits, all using the given probability class
+	template <typename OutputStream>
+	void Encode(BitArray& inputBitArray, OutputStream& outputBitStream, uint8_t probabilityClass = 0) const {
+		CheckClass(probabilityClass);
+
+		const Transition* classTransitions = transitions.data() + (probabilityClass * 2);
+		int64_t transitionStride = ClassCount() * 2;
+
+		uint32_t state = 0;
+		int64_t pendingBitCount = 0;
+
+		for (int64_t readPosition = 0; readPosition < inputBitArray.BitLength(); readPosition++) {
+			uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+
+			auto& transition = classTransitions[(state * transitionStride) + inputBit];
+
+			OutputTransitionBits(transition, pendingBitCount, outputBitStream);
+
+			state = transition.nextState;
+		}
+
+		FinishEncoding(state, pendingBitCount, outputBitStream);
+	}
+
+	// Encode message bits, each using the probability class given for it
+	template <typename OutputStream>
+	void Encode(BitArray& inputBitArray, const uint8_t* probabilityClasses, OutputStream& outputBitStream) const {
+		uint32_t state = 0;
+		int64_t pendingBitCount = 0;
+
+		for (int64_t readPosition = 0; readPosition < inputBitArray.BitLength(); readPosition++) {
+			uint8_t probabilityClass = probabilityClasses[readPosition];
+			CheckClass(probabilityClass);
+
+			uint8_t inputBit = inputBitArray.ReadBitAt(readPosition);
+
+			auto& transition = transitions[TransitionIndex(state, probabilityClass, inputBit)];
+
+			OutputTransitionBits(transition, pendingBitCount, outputBitStream);
+
+			state = transition.nextState;
+		}
+
+		FinishEncoding(state, pendingBitCount, outputBitStream);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Decoding
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Decode message bits, all using the given probability class.
+	// outputBitArray should be pre-sized (and zeroed) to the expected decoded message length.
+	//
+	// Uses the multi-symbol decoder table of the class, if it has been built.
+	void Decode(BitArray& inputBitArray, BitArray& outputBitArray, uint8_t probabilityClass = 0) const {
+		CheckClass(probabilityClass);
+
+		if (HasMultiSymbolDecoderTable(probabilityClass)) {
+			DecodeSingleClass(inputBitArray, outputBitArray, probabilityClass);
+
+			return;
+		}
+
+		uint32_t state = 0;
+		int64_t readPosition = 0;
+		uint32_t value = ReadBits(inputBitArray, readPosition, rangeBitWidth);
+
+		for (int64_t writePosition = 0; writePosition < outputBitArray.BitLength(); writePosition++) {
+			outputBitArray.WriteBitAt(writePosition, DecodeBit(state, value, probabilityClass, inputBitArray, readPosition));
+		}
+	}
+
+	// Decode message bits, each using the probability class given for it.
+	// outputBitArray should be pre-sized (and zeroed) to the expected decoded message length.
+	void Decode(BitArray& inputBitArray, const uint8_t* probabilityClasses, BitArray& outputBitArray) const {
+		uint32_t state = 0;
+		int64_t readPosition = 0;
+		uint32_t value = ReadBits(inputBitArray, readPosition, rangeBitWidth);
+
+		for (int64_t writePosition = 0; writePosition < outputBitArray.BitLength(); writePosition++) {
+			uint8_t probabilityClass = probabilityClasses[writePosition];
+			CheckClass(probabilityClass);
+
+			outputBitArray.WriteBitAt(writePosition, DecodeBit(state, value, probabilityClass, inputBitArray, readPosition));
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Multi-symbol decoder tables
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Build the multi-symbol decoder table of the given probability class
+	// (optional, needs to be explicitly called to enable multi-symbol decoding).
+	//
+	// Thread-safe. If called concurrently, the table is built once, and all callers
+	// return after it is ready.
+	void BuildMultiSymbolDecoderTable(uint8_t probabilityClass = 0) const {
+		CheckClass(probabilityClass);
+
+		auto& table = *(*multiSymbolDecoderTables)[probabilityClass];
+
+		if (table.isReady.load(std::memory_order_acquire)) {
+			return;
+		}
+
+		std::call_once(table.onceFlag, [&]() {
+			uint32_t windowBitWidth = rangeBitWidth + lookaheadBitWidth;
+			uint32_t windowCount = 1u << windowBitWidth;
+
+			table.entries.resize(uint64_t(StateCount()) * windowCount);
+
+			for (uint32_t state = 0; state < uint32_t(StateCount()); state++) {
+				for (uint32_t window = 0; window < windowCount; window++) {
+					table.entries[(uint64_t(state) * windowCount) + window] = ComputeMultiSymbolDecoderEntry(state, window, probabilityClass);
+				}
+			}
+
+			table.isReady.store(true, std::memory_order_release);
+		});
+	}
+
+	// Has the multi-symbol decoder table of the given probability class been built?
+	bool HasMultiSymbolDecoderTable(uint8_t probabilityClass = 0) const {
+		return (*multiSymbolDecoderTables)[probabilityClass]->isReady.load(std::memory_order_acquire);
+	}
+
+	// Computes the total memory size, in bytes, required by a multi-symbol decoder table
+	uint64_t GetMultiSymbolDecoderTableMemorySize() const {
+		return uint64_t(StateCount()) * (1ULL << (rangeBitWidth + lookaheadBitWidth)) * sizeof(MultiSymbolDecoderEntry);
+	}
+
+   private:
+	void CheckClass(uint8_t probabilityClass) const {
+		if (probabilityClass >= ClassCount()) {
+			throw std::exception("Probability class is out of range.");
+		}
+	}
+
+	int64_t TransitionIndex(uint32_t state, uint8_t probabilityClass, uint8_t bit) const {
+		return (((int64_t(state) * ClassCount()) + probabilityClass) * 2) + bit;
+	}
+
+	// Outputs the bits of a transition, and updates the pending bit count
+	template <typename OutputStream>
+	static void OutputTransitionBits(const Transition& transition, int64_t& pendingBitCount, OutputStream& outputBitStream) {
+		int sharedBitCount = transition.sharedBitCount;
+
+		if (sharedBitCount > 0) {
+			// The first shared bit resolves the pending bits, which are its complement
+			uint8_t firstBit = uint8_t(transition.sharedBits >> (sharedBitCount - 1));
+
+			outputBitStream.WriteBit(firstBit);
+
+			for (; pendingBitCount > 0; pendingBitCount--) {
+				outputBitStream.WriteBit(firstBit ^ 1);
+			}
+
+			for (int i = sharedBitCount - 2; i >= 0; i--) {
+				outputBitStream.WriteBit(uint8_t((transition.sharedBits >> i) & 1));
+			}
+		}
+
+		pendingBitCount += transition.middleShiftCount;
+	}
+
+	// Outputs the final bits (see `BinaryArithmeticCoder::FinishEncoding`)
+	template <typename OutputStream>
+	void FinishEncoding(uint32_t state, int64_t pendingBitCount, OutputStream& outputBitStream) const {
+		pendingBitCount += 1;
+
+		uint8_t firstBit = stateLow[state] < quarterRange ? 0 : 1;
+
+		outputBitStream.WriteBit(firstBit);
+
+		for (; pendingBitCount > 0; pendingBitCount--) {
+			outputBitStream.WriteBit(firstBit ^ 1);
+		}
+	}
+
+	// Reads encoded bits, the first one as the most significant. Reads zeros past the end.
+	static uint32_t ReadBits(BitArray& inputBitArray, int64_t& readPosition, int bitCount) {
+		uint32_t bits = 0;
+
+		for (int i = 0; i < bitCount; i++) {
+			uint8_t bit = readPosition < inputBitArray.BitLength() ? inputBitArray.ReadBitAt(readPosition) : 0;
+
+			bits = (bits << 1) | bit;
+			readPosition++;
+		}
+
+		return bits;
+	}
+
+	// Decodes a single bit. `value` holds the next `rangeBitWidth` bits of the code value,
+	// relative to the interval's scale.
+	inline uint8_t DecodeBit(uint32_t& state, uint32_t& value, uint8_t probabilityClass, BitArray& inputBitArray, int64_t& readPosition) const {
+		uint8_t bit = value >= boundaries[(state * ClassCount()) + probabilityClass] ? 1 : 0;
+
+		auto& transition = transitions[TransitionIndex(state, probabilityClass, bit)];
+
+		value = ApplyShifts(value, transition, rangeBitWidth);
+		value |= ReadBits(inputBitArray, readPosition, transition.sharedBitCount + transition.middleShiftCount);
+
+		state = transition.nextState;
+
+		return bit;
+	}
+
+	// Applies a transition's normalization to a value whose top `valueBitWidth` bits are at the
+	// interval's scale (and any lower bits are lookahead bits). Each shared bit shifts the value,
+	// and each middle half normalization maps it to `2 * value - halfRange`, which is a shift and a
+	// flip of the top bit. The shifted-in bits are 0.
+	uint32_t ApplyShifts(uint32_t value, const Transition& transition, int valueBitWidth) const {
+		int shiftCount = transition.sharedBitCount + transition.middleShiftCount;
+
+		value <<= shiftCount;
+
+		if (transition.middleShiftCount > 0) {
+			value ^= 1u << (valueBitWidth - 1);
+		}
+
+		return value & ((1u << valueBitWidth) - 1);
+	}
+
+	// Decode with a multi-symbol decoder table. The decoder keeps a window of the value, followed
+	// by `lookaheadBitWidth` upcoming encoded bits, and each lookup decodes all bits whose
+	// decisions only depend on the known bits of the window.
+	void DecodeSingleClass(BitArray& inputBitArray, BitArray& outputBitArray, uint8_t probabilityClass) const {
+		auto& entries = (*multiSymbolDecoderTables)[probabilityClass]->entries;
+
+		int windowBitWidth = rangeBitWidth + lookaheadBitWidth;
+		uint32_t windowMask = (1u << windowBitWidth) - 1;
+
+		int64_t outputBitLength = outputBitArray.BitLength();
+
+		uint32_t state = 0;
+		int64_t readPosition = 0;
+		uint32_t window = ReadBits(inputBitArray, readPosition, windowBitWidth);
+
+		int64_t writePosition = 0;
+
+		// Decode with the multi-symbol table, while a lookup can't decode past the end of the message
+		while (outputBitLength - writePosition >= maxSymbolsPerLookup) {
+			auto& entry = entries[(uint64_t(state) << windowBitWidth) + window];
+
+			for (int i = 0; i < entry.symbolCount; i++) {
+				outputBitArray.WriteBitAt(writePosition + i, uint8_t((entry.symbols >> i) & 1));
+			}
+
+			writePosition += entry.symbolCount;
+
+			int consumedBitCount = entry.consumedBitCountAndFlip & 127;
+
+			// (the flip is applied after reading, since when the whole window is consumed, the top bit
+			// is a newly read one)
+			window = uint32_t(uint64_t(window) << consumedBitCount) & windowMask;
+			window |= ReadBits(inputBitArray, readPosition, consumedBitCount);
+
+			if (entry.consumedBitCountAndFlip & 128) {
+				window ^= 1u << (windowBitWidth - 1);
+			}
+
+			state = entry.nextState;
+		}
+
+		// Decode the remaining bits one by one. The value is the top of the window, and the lookahead
+		// bits haven't been consumed yet.
+		uint32_t value = window >> lookaheadBitWidth;
+		readPosition -= lookaheadBitWidth;
+
+		for (; writePosition < outputBitLength; writePosition++) {
+			outputBitArray.WriteBitAt(writePosition, DecodeBit(state, value, probabilityClass, inputBitArray, readPosition));
+		}
+	}
+
+	// Computes the multi-symbol decoder entry for the given state and window, by decoding bits
+	// while the value is fully known (the unknown bits shifted into the window are all below it).
+	MultiSymbolDecoderEntry ComputeMultiSymbolDecoderEntry(uint32_t state, uint32_t window, uint8_t probabilityClass) const {
+		int windowBitWidth = rangeBitWidth + lookaheadBitWidth;
+
+		MultiSymbolDecoderEntry entry = {};
+
+		int consumedBitCount = 0;
+		bool isFlipped = false;
+
+		while (entry.symbolCount < maxSymbolsPerLookup && windowBitWidth - consumedBitCount >= rangeBitWidth) {
+			uint32_t value = window >> lookaheadBitWidth;
+			uint8_t bit = value >= boundaries[(state * ClassCount()) + probabilityClass] ? 1 : 0;
+
+			auto& transition = transitions[TransitionIndex(state, probabilityClass, bit)];
+			int shiftCount = transition.sharedBitCount + transition.middleShiftCount;
+
+			window = ApplyShifts(window, transition, windowBitWidth);
+
+			// A flip of the top bit is only kept if no later shift moves it out of the window
+			if (shiftCount > 0) {
+				isFlipped = transition.middleShiftCount > 0;
+			}
+
+			entry.symbols |= uint16_t(bit) << entry.symbolCount;
+			entry.symbolCount++;
+
+			consumedBitCount += shiftCount;
+			state = transition.nextState;
+		}
+
+		entry.nextState = state;
+		entry.consumedBitCountAndFlip = uint8_t(consumedBitCount | (isFlipped ? 128 : 0));
+
+		return entry;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// State space construction
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Finds the states reachable from the initial interval [0, range), and their transitions
+	void BuildStatesAndTransitions() {
+		// State index of each (low, high) pair, or -1 if not yet reached
+		std::vector<int32_t> stateIndexOf(uint64_t(range + 1) * (range + 1), -1);
+
+		auto getOrAddState = [&](uint32_t low, uint32_t high) {
+			int32_t& stateIndex = stateIndexOf[(uint64_t(low) * (range + 1)) + high];
+
+			if (stateIndex < 0) {
+				stateIndex = int32_t(stateLow.size());
+
+				stateLow.push_back(uint16_t(low));
+				stateHigh.push_back(uint16_t(high));
+			}
+
+			return uint32_t(stateIndex);
+		};
+
+		getOrAddState(0, range);
+
+		// States are appended as they are found, so iterating in index order is a breadth-first search
+		for (uint32_t state = 0; state < stateLow.size(); state++) {
+			for (size_t probabilityClass = 0; probabilityClass < probabilityOf0OfClass.size(); probabilityClass++) {
+				uint32_t low = stateLow[state];
+				uint32_t high = stateHigh[state];
+				uint32_t intervalLength = high - low;
+
+				// Both subintervals must be non-empty. Normalized intervals are longer than a quarter
+				// of the range, so this is always possible.
+				auto lowerSubintervalLength = uint32_t(std::lround(intervalLength * probabilityOf0OfClass[probabilityClass]));
+				lowerSubintervalLength = clip(lowerSubintervalLength, 1u, intervalLength - 1);
+
+				uint32_t boundary = low + lowerSubintervalLength;
+
+				boundaries.push_back(uint16_t(boundary));
+
+				for (uint8_t bit = 0; bit <= 1; bit++) {
+					Transition transition = bit == 0 ? Normalize(low, boundary) : Normalize(boundary, high);
+
+					// The transition holds the normalized bounds in its next state field, until the
+					// state is looked up
+					uint32_t nextLow = transition.nextState >> 16;
+					uint32_t nextHigh = transition.nextState & 0xFFFF;
+
+					transition.nextState = getOrAddState(nextLow, nextHigh);
+
+					transitions.push_back(transition);
+				}
+			}
+		}
+	}
+
+	// Normalizes the interval [low, high), and returns the transition's outputs, with the normalized
+	// bounds packed in the next state field (low in the upper 16 bits)
+	Transition Normalize(uint32_t low, uint32_t high) const {
+		Transition transition = {};
+
+		while (true) {
+			if (high <= halfRange) {  // Interval is in the lower half
+				transition.sharedBits = uint16_t(transition.sharedBits << 1);
+				transition.sharedBitCount++;
+
+				low *= 2;
+				high *= 2;
+			} else if (low >= halfRange) {  // Interval is in the upper half
+				transition.sharedBits = uint16_t((transition.sharedBits << 1) | 1);
+				transition.sharedBitCount++;
+
+				low = (low - halfRange) * 2;
+				high = (high - halfRange) * 2;
+			} else if (low >= quarterRange && high <= halfRange + quarterRange) {  // Interval is in the middle half
+				transition.middleShiftCount++;
+
+				low = (low - quarterRange) * 2;
+				high = (high - quarterRange) * 2;
+			} else {
+				break;
+			}
+		}
+
+		transition.nextState = (low << 16) | high;
+
+		return transition;
+	}
+};
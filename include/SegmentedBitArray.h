@@ -0,0 +1,54 @@
+#pragma once
+
+#include "BitArray.h"
+
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+// A sequence of non-contiguous bit array segments, viewed as a single logical bit array
+// (similar to an iovec array).
+//
+// Allows encoding a message from (or decoding it into) separate buffers, like network buffers
+// or column chunks, without first copying them into a single contiguous buffer. Segments can have
+// any bit length, including lengths that aren't a multiple of 8, and zero.
+//
+// Segments only reference their bytes. The referenced memory must outlive the segmented array.
+class SegmentedBitArray {
+   private:
+	std::vector<BitArray> segments;
+	int64_t bitLength = 0;
+
+   public:
+	SegmentedBitArray() {
+	}
+
+	SegmentedBitArray(std::vector<BitArray> initialSegments) {
+		for (auto& segment : initialSegments) {
+			AddSegment(segment);
+		}
+	}
+
+	// Appends a segment, referencing the given bytes
+	void AddSegment(uint8_t* bytes, int64_t segmentBitLength) {
+		AddSegment(BitArray(bytes, segmentBitLength));
+	}
+
+	void AddSegment(BitArray segment) {
+		if (segment.BitLength() < 0) {
+			throw std::exception("Segment bit length can't be negative.");
+		}
+
+		segments.push_back(segment);
+		bitLength += segment.BitLength();
+	}
+
+	int64_t SegmentCount() { return int64_t(segments.size()); }
+
+	BitArray& Segment(int64_t segmentIndex) { return segments[segmentIndex]; }
+
+	std::vector<BitArray>& Segments() { return segments; }
+
+	// Total bit length of all segments
+	int64_t BitLength() { return bitLength; }
+};
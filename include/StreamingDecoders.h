@@ -0,0 +1,306 @@
+#pragma once
+
+#include "BitArray.h"
+#include "BinaryArithmeticCoder.h"
+#include "BinaryRangeANSCoder.h"
+#include "FastUint32MultiplicationByFraction.h"
+
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Pull-based (lazy) decoders.
+//
+// Instead of decoding a full message into a pre-sized bit array, the decoded bits are pulled
+// on demand, in batches of up to 64 bits (`DecodeWord`), or one at a time (`NextBit`).
+// Decoding can be stopped at any point, without decoding the rest of the message.
+//
+// Encoded bytes are given incrementally, using `AppendInput`. When the decoder runs out of input
+// it suspends (returns fewer bits than requested, with `NeedsInput()` returning true), and resumes
+// once more input is appended. Calling `EndInput` signals that there is no more input.
+//////////////////////////////////////////////////////////////////////////////////////////////
+
+// Buffer of encoded bytes that were appended, but not yet consumed
+class StreamingInputBuffer {
+   private:
+	std::vector<uint8_t> bytes;
+	int64_t consumedByteCount = 0;
+	bool ended = false;
+
+   public:
+	void Append(const uint8_t* newBytes, int64_t length) {
+		if (ended) {
+			throw std::exception("Can't append input after input has ended.");
+		}
+
+		// Discard consumed bytes, once they make up most of the buffer
+		if (consumedByteCount > 0 && consumedByteCount * 2 >= int64_t(bytes.size())) {
+			bytes.erase(bytes.begin(), bytes.begin() + consumedByteCount);
+			consumedByteCount = 0;
+		}
+
+		bytes.insert(bytes.end(), newBytes, newBytes + length);
+	}
+
+	void End() { ended = true; }
+
+	bool HasEnded() { return ended; }
+
+	// Unconsumed bytes
+	uint8_t* Data() { return bytes.data() + consumedByteCount; }
+	int64_t ByteLength() { return int64_t(bytes.size()) - consumedByteCount; }
+
+	void Consume(int64_t byteCount) { consumedByteCount += byteCount; }
+};
+
+// Pull-based binary rANS decoder
+class BinaryRangeANSStreamingDecoder {
+   private:
+	const BinaryRangeANSCoder& coder;
+
+	uint32_t state;
+	uint32_t totalFrequency;
+	int64_t remainingBitCount;
+
+	StreamingInputBuffer input;
+
+	bool needsInput = false;
+
+	// Bits decoded by `DecodeWord`, not yet returned by `NextBit`
+	uint64_t bufferedBits = 0;
+	int64_t bufferedBitCount = 0;
+
+   public:
+	// Creates a decoder for a message of the given bit length, encoded with the given coder.
+	// The coder must outlive the decoder.
+	BinaryRangeANSStreamingDecoder(const BinaryRangeANSCoder& coder, uint32_t finalState, int64_t bitLength)
+		: coder(coder) {
+
+		this->state = finalState;
+		this->totalFrequency = coder.GetTotalFrequency();
+		this->remainingBitCount = bitLength;
+	}
+
+	// Appends encoded bytes
+	void AppendInput(const uint8_t* bytes, int64_t length) {
+		input.Append(bytes, length);
+
+		needsInput = false;
+	}
+
+	// Signals that all encoded bytes have been appended
+	void EndInput() {
+		input.End();
+
+		needsInput = false;
+	}
+
+	// Decodes up to 64 bits into the given word, starting from its least significant bit.
+	// Bits already decoded but not yet returned by `NextBit` are returned first.
+	//
+	// Returns the number of bits in the word. It is fewer than 64 only when the message
+	// ends, or when more input is needed.
+	int64_t DecodeWord(uint64_t& word) {
+		// Start with any bits buffered by `NextBit`
+		word = bufferedBits;
+
+		int64_t decodedBitCount = bufferedBitCount;
+
+		bufferedBits = 0;
+		bufferedBitCount = 0;
+
+		needsInput = false;
+
+		int64_t bitCount = decodedBitCount + (remainingBitCount < 64 - decodedBitCount ? remainingBitCount : 64 - decodedBitCount);
+		int64_t previouslyBufferedBitCount = decodedBitCount;
+
+		uint8_t* encodedBytes = input.Data();
+		int64_t encodedByteLength = input.ByteLength();
+		int64_t readPosition = 0;
+
+		while (decodedBitCount < bitCount) {
+			// Read bytes into the state while below the threshold.
+			// If no more bytes are available, and input hasn't ended, suspend.
+			while (state < totalFrequency) {
+				if (readPosition < encodedByteLength) {
+					state = (state << 8) | uint32_t(encodedBytes[readPosition++]);
+				} else if (input.HasEnded()) {
+					break;
+				} else {
+					needsInput = true;
+					break;
+				}
+			}
+
+			if (needsInput) {
+				break;
+			}
+
+			auto stateTransitionResult = coder.ComputeDecoderStateTransitionFor(state);
+
+			state = stateTransitionResult.state;
+
+			word |= uint64_t(stateTransitionResult.symbol) << decodedBitCount;
+
+			decodedBitCount += 1;
+		}
+
+		input.Consume(readPosition);
+
+		remainingBitCount -= decodedBitCount - previouslyBufferedBitCount;
+
+		return decodedBitCount;
+	}
+
+	// Gets the next decoded bit. Returns false if the message has ended, or more input is needed.
+	bool NextBit(uint8_t& bit) {
+		if (bufferedBitCount == 0) {
+			bufferedBitCount = DecodeWord(bufferedBits);
+
+			if (bufferedBitCount == 0) {
+				return false;
+			}
+		}
+
+		bit = uint8_t(bufferedBits & 1);
+
+		bufferedBits >>= 1;
+		bufferedBitCount -= 1;
+
+		return true;
+	}
+
+	// Has decoding been suspended, waiting for more input?
+	bool NeedsInput() { return needsInput; }
+
+	// Have all message bits been decoded (and returned)?
+	bool IsFinished() { return remainingBitCount == 0 && bufferedBitCount == 0; }
+};
+
+// Pull-based binary arithmetic decoder
+class BinaryArithmeticStreamingDecoder {
+   private:
+	FastUint32MultiplicationByFraction fastMultiplicationByProbabilityOf0;
+
+	BinaryArithmeticCoder::DecoderState state;
+	bool isInitialized = false;
+
+	int64_t remainingBitCount;
+
+	StreamingInputBuffer input;
+
+	bool needsInput = false;
+
+	// Bits decoded by `DecodeWord`, not yet returned by `NextBit`
+	uint64_t bufferedBits = 0;
+	int64_t bufferedBitCount = 0;
+
+	// A single decoded bit can trigger up to 32 normalization shifts, each reading one encoded bit.
+	// Unless input has ended, this many bits must be available before decoding a bit.
+	static constexpr int64_t requiredLookaheadBitCount = BinaryArithmeticCoder::totalRangeBitWidth;
+
+   public:
+	// Creates a decoder for a message of the given bit length
+	BinaryArithmeticStreamingDecoder(double probabilityOf1, int64_t bitLength)
+		: fastMultiplicationByProbabilityOf0(BinaryArithmeticCoder::CreateFastMultiplicationByProbabilityOf0(probabilityOf1)) {
+
+		this->remainingBitCount = bitLength;
+	}
+
+	// Appends encoded bytes
+	void AppendInput(const uint8_t* bytes, int64_t length) {
+		input.Append(bytes, length);
+
+		needsInput = false;
+	}
+
+	// Signals that all encoded bytes have been appended
+	void EndInput() {
+		input.End();
+
+		needsInput = false;
+	}
+
+	// Decodes up to 64 bits into the given word, starting from its least significant bit.
+	// Bits already decoded but not yet returned by `NextBit` are returned first.
+	//
+	// Returns the number of bits in the word. It is fewer than 64 only when the message
+	// ends, or when more input is needed.
+	int64_t DecodeWord(uint64_t& word) {
+		// Start with any bits buffered by `NextBit`
+		word = bufferedBits;
+
+		int64_t decodedBitCount = bufferedBitCount;
+
+		bufferedBits = 0;
+		bufferedBitCount = 0;
+
+		needsInput = false;
+
+		int64_t bitCount = decodedBitCount + (remainingBitCount < 64 - decodedBitCount ? remainingBitCount : 64 - decodedBitCount);
+		int64_t previouslyBufferedBitCount = decodedBitCount;
+
+		// Encoded bits are read from the start of the unconsumed input. The trailing zero padding
+		// of the encoded bytes is equivalent to the zeros the decoder reads past the end.
+		BitArray inputBitArray(input.Data(), input.ByteLength() * 8);
+
+		if (!isInitialized && remainingBitCount > 0) {
+			if (inputBitArray.BitLength() < requiredLookaheadBitCount && !input.HasEnded()) {
+				needsInput = true;
+				return decodedBitCount;
+			}
+
+			BinaryArithmeticCoder::InitializeDecoder(state, inputBitArray);
+
+			isInitialized = true;
+		}
+
+		while (decodedBitCount < bitCount) {
+			if (inputBitArray.BitLength() - state.readPosition < requiredLookaheadBitCount && !input.HasEnded()) {
+				needsInput = true;
+				break;
+			}
+
+			uint8_t bit = BinaryArithmeticCoder::DecodeBit(state, inputBitArray, fastMultiplicationByProbabilityOf0);
+
+			word |= uint64_t(bit) << decodedBitCount;
+
+			decodedBitCount += 1;
+		}
+
+		// Consume whole bytes that were fully read
+		int64_t consumedByteCount = state.readPosition / 8;
+
+		input.Consume(consumedByteCount);
+		state.readPosition -= consumedByteCount * 8;
+
+		remainingBitCount -= decodedBitCount - previouslyBufferedBitCount;
+
+		return decodedBitCount;
+	}
+
+	// Gets the next decoded bit. Returns false if the message has ended, or more input is needed.
+	bool NextBit(uint8_t& bit) {
+		if (bufferedBitCount == 0) {
+			bufferedBitCount = DecodeWord(bufferedBits);
+
+			if (bufferedBitCount == 0) {
+				return false;
+			}
+		}
+
+		bit = uint8_t(bufferedBits & 1);
+
+		bufferedBits >>= 1;
+		bufferedBitCount -= 1;
+
+		return true;
+	}
+
+	// Has decoding been suspended, waiting for more input?
+	bool NeedsInput() { return needsInput; }
+
+	// Have all message bits been decoded (and returned)?
+	bool IsFinished() { return remainingBitCount == 0 && bufferedBitCount == 0; }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Utilities.h"
+#include "FastUint31Division.h"
+
+#include <cstdint>
+#include <exception>
+
+// Alternative strategies for computing the quotient and remainder of an unsigned 32-bit integer
+// divided by a fixed divisor.
+//
+// All strategies produce exactly the same results for the range of values they support, so they
+// can be freely swapped without affecting the encoded output. They only differ in speed,
+// which varies considerably between CPUs (on recent CPUs, the hardware 32-bit `div` instruction
+// has become cheap enough to compete with multiplication-based approaches).
+//
+// Use `DivisionBenchmark.h` to measure them on the current CPU.
+enum class Uint32DivisionStrategy : uint8_t {
+	// Select the fastest strategy for the current CPU, using a short benchmark run once per process
+	Automatic = 0,
+
+	// Plain `/` and `%` operators
+	Hardware = 1,
+
+	// "Magic number" multiplication and shift (`FastUint31Division`)
+	MagicNumber = 2,
+
+	// Lemire-style 64-bit fraction multiplication ("fastmod")
+	Lemire = 3,
+
+	// Double precision reciprocal multiplication, with a single correction step
+	Reciprocal = 4,
+};
+
+// Uses the hardware division instruction. Supports any non-zero 32-bit divisor.
+class HardwareUint32Division {
+   private:
+	uint32_t divisor;
+
+   public:
+	HardwareUint32Division() {
+		divisor = 1;
+	}
+
+	HardwareUint32Division(uint32_t divisor) {
+		if (divisor == 0) {
+			throw std::exception("Divisor can't be 0");
+		}
+
+		this->divisor = divisor;
+	}
+
+	inline uint32_t Divide(uint32_t numerator) const {
+		return numerator / divisor;
+	}
+
+	inline QuotientAndRemainderUint32 DivideAndGetRemainder(uint32_t numerator) const {
+		return { numerator / divisor, numerator % divisor };
+	}
+};
+
+// Computes the quotient and remainder using a precomputed 64-bit fixed-point
+// approximation of `1 / divisor`, and two high-half 64-bit multiplications.
+//
+// Works for all 32-bit numerators and non-zero 32-bit divisors.
+//
+// Based on:
+// "Faster Remainder by Direct Computation: Applications to Compilers and Software Libraries",
+// by Daniel Lemire, Owen Kaser and Nathan Kurz (2019)
+class LemireUint32Division {
+   private:
+	uint32_t divisor;
+
+	uint64_t fraction;
+
+	// All ones when the divisor is 1, otherwise 0.
+	//
+	// The fraction for a divisor of 1 would be 2^64, which overflows to 0. In that case the
+	// remainder is still computed correctly (always 0), and the quotient is recovered by
+	// OR-ing in the numerator, without introducing a branch.
+	uint32_t divisorIsOneMask;
+
+   public:
+	LemireUint32Division() : LemireUint32Division(1) {
+	}
+
+	LemireUint32Division(uint32_t divisor) {
+		if (divisor == 0) {
+			throw std::exception("Divisor can't be 0");
+		}
+
+		this->divisor = divisor;
+
+		// fraction = ceil(2^64 / divisor)
+		fraction = (UINT64_MAX / divisor) + 1;
+
+		divisorIsOneMask = divisor == 1 ? UINT32_MAX : 0;
+	}
+
+	inline uint32_t Divide(uint32_t numerator) const {
+		return uint32_t(EntropyCodingUtilities::multiplyHigh64(fraction, numerator)) | (numerator & divisorIsOneMask);
+	}
+
+	inline QuotientAndRemainderUint32 DivideAndGetRemainder(uint32_t numerator) const {
+		uint32_t quotient = uint32_t(EntropyCodingUtilities::multiplyHigh64(fraction, numerator)) | (numerator & divisorIsOneMask);
+
+		// The low 64 bits of the product hold the fractional part of `numerator / divisor`.
+		// Multiplying it by the divisor gives the remainder in the high 64 bits.
+		uint64_t fractionalPart = fraction * numerator;
+		uint32_t remainder = uint32_t(EntropyCodingUtilities::multiplyHigh64(fractionalPart, divisor));
+
+		return { quotient, remainder };
+	}
+};
+
+// Computes the quotient by multiplying with a precomputed double precision reciprocal.
+//
+// The product can be smaller than the true quotient by at most 1, when the numerator is an
+// exact multiple of the divisor, and the rounded reciprocal is slightly too small.
+// A single (branchless) correction step fixes that.
+//
+// Works for all 32-bit numerators and non-zero 32-bit divisors.
+class ReciprocalUint32Division {
+   private:
+	uint32_t divisor;
+
+	double reciprocal;
+
+   public:
+	ReciprocalUint32Division() : ReciprocalUint32Division(1) {
+	}
+
+	ReciprocalUint32Division(uint32_t divisor) {
+		if (divisor == 0) {
+			throw std::exception("Divisor can't be 0");
+		}
+
+		this->divisor = divisor;
+
+		reciprocal = 1.0 / double(divisor);
+	}
+
+	inline uint32_t Divide(uint32_t numerator) const {
+		return DivideAndGetRemainder(numerator).quotient;
+	}
+
+	inline QuotientAndRemainderUint32 DivideAndGetRemainder(uint32_t numerator) const {
+		uint32_t quotient = uint32_t(double(numerator) * reciprocal);
+		uint32_t remainder = numerator - (quotient * divisor);
+
+		// Correct an underestimated quotient
+		uint32_t correction = remainder >= divisor;
+
+		quotient += correction;
+		remainder -= correction * divisor;
+
+		return { quotient, remainder };
+	}
+};
@@ -1,6 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+
+#if __cplusplus >= 202002L
+#include <bit>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <stdlib.h>
+#endif
 
 namespace EntropyCodingUtilities {
 
@@ -17,4 +27,151 @@ T clip(T num, T min, T max) {
 	return num;
 }
 
+// Computes the high 64 bits of the 128-bit product of two unsigned 64-bit integers
+inline uint64_t multiplyHigh64(uint64_t a, uint64_t b) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	return __umulh(a, b);
+#elif defined(__SIZEOF_INT128__)
+	return uint64_t((unsigned __int128)(a) * b >> 64);
+#else
+	// Otherwise fall back to slower version, based on 32-bit partial products
+	uint64_t aLow = a & 0xFFFFFFFF;
+	uint64_t aHigh = a >> 32;
+	uint64_t bLow = b & 0xFFFFFFFF;
+	uint64_t bHigh = b >> 32;
+
+	uint64_t lowLow = aLow * bLow;
+	uint64_t lowHigh = aLow * bHigh;
+	uint64_t highLow = aHigh * bLow;
+	uint64_t highHigh = aHigh * bHigh;
+
+	uint64_t middle = (lowLow >> 32) + (lowHigh & 0xFFFFFFFF) + (highLow & 0xFFFFFFFF);
+
+	return highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+#endif
+}
+
+// Counts the 1 bits in an unsigned 64-bit integer
+inline int popcount64(uint64_t value) {
+#if __cplusplus >= 202002L
+	// If compiled with C++20 or higher supported, use std::popcount
+	return std::popcount(value);
+#elif defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(value);
+#else
+	// Otherwise fall back to slower version, counting bits in parallel within the word
+	value = value - ((value >> 1) & 0x5555555555555555ULL);
+	value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+	value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+	return int((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Counts the leading 0 bits in an unsigned 64-bit integer. Returns 64 for 0.
+inline int countLeadingZeros64(uint64_t value) {
+#if __cplusplus >= 202002L
+	return std::countl_zero(value);
+#elif defined(__GNUC__) || defined(__clang__)
+	return value == 0 ? 64 : __builtin_clzll(value);
+#else
+	// Otherwise fall back to slower version, using a binary search for the highest 1 bit
+	if (value == 0) {
+		return 64;
+	}
+
+	int count = 0;
+
+	for (int shift = 32; shift > 0; shift /= 2) {
+		if ((value >> (64 - shift)) == 0) {
+			count += shift;
+			value <<= shift;
+		}
+	}
+
+	return count;
+#endif
+}
+
+// Counts the trailing 0 bits in an unsigned 64-bit integer. Returns 64 for 0.
+inline int countTrailingZeros64(uint64_t value) {
+#if __cplusplus >= 202002L
+	return std::countr_zero(value);
+#elif defined(__GNUC__) || defined(__clang__)
+	return value == 0 ? 64 : __builtin_ctzll(value);
+#else
+	// Otherwise fall back to slower version: isolate the lowest 1 bit, and count the bits below it
+	if (value == 0) {
+		return 64;
+	}
+
+	return popcount64((value & (0 - value)) - 1);
+#endif
+}
+
+// Counts the leading 0 bits in an unsigned 32-bit integer. Returns 32 for 0.
+//
+// The set bit below the shifted value makes the argument nonzero, so no special case
+// (and no branch) is needed for 0.
+inline int countLeadingZeros32(uint32_t value) {
+	return countLeadingZeros64((uint64_t(value) << 32) | (1ULL << 31));
+}
+
+// Reverses the byte order of an unsigned 64-bit integer
+inline uint64_t byteSwap64(uint64_t value) {
+#if defined(_MSC_VER)
+	return _byteswap_uint64(value);
+#elif defined(__GNUC__) || defined(__clang__)
+	return __builtin_bswap64(value);
+#else
+	// Otherwise fall back to slower version, swapping bytes, then pairs, then halves
+	value = ((value >> 8) & 0x00FF00FF00FF00FFULL) | ((value & 0x00FF00FF00FF00FFULL) << 8);
+	value = ((value >> 16) & 0x0000FFFF0000FFFFULL) | ((value & 0x0000FFFF0000FFFFULL) << 16);
+
+	return (value >> 32) | (value << 32);
+#endif
+}
+
+// Loads 8 bytes as a big-endian unsigned 64-bit integer
+inline uint64_t loadBigEndian64(const uint8_t* bytes) {
+	uint64_t value;
+	std::memcpy(&value, bytes, sizeof(value));
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return value;
+#else
+	return byteSwap64(value);
+#endif
+}
+
+// Loads 8 bytes as a little-endian unsigned 64-bit integer
+inline uint64_t loadLittleEndian64(const uint8_t* bytes) {
+	uint64_t value;
+	std::memcpy(&value, bytes, sizeof(value));
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return byteSwap64(value);
+#else
+	return value;
+#endif
+}
+
+// Stores an unsigned 64-bit integer as 8 big-endian bytes
+inline void storeBigEndian64(uint8_t* bytes, uint64_t value) {
+#if !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	value = byteSwap64(value);
+#endif
+
+	std::memcpy(bytes, &value, sizeof(value));
+}
+
+// Reverses the order of the bits within each of the 8 bytes of an unsigned 64-bit integer
+inline uint64_t reverseBitsWithinBytes64(uint64_t value) {
+	value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+	value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+	value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+
+	return value;
+}
+
 }  // namespace EntropyCodingUtilities